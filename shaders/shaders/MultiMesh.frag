@@ -0,0 +1,12 @@
+#version 460
+
+layout(location = 0) in vec3 uvw;
+layout(location = 1) flat in uint materialIndex;
+
+layout(location = 0) out vec4 outColor;
+
+
+void main()
+{
+    outColor = vec4(fract(uvw), 1.0);
+}
@@ -0,0 +1,63 @@
+#version 460
+
+layout(location = 0) out vec3 uvw;
+layout(location = 1) flat out uint materialIndex;
+
+layout(binding = 0) uniform UniformBuffer
+{
+    mat4 mvp;
+} ubo;
+
+struct InstanceData
+{
+    mat4 transform;
+    uint meshIndex;
+    uint materialIndex;
+    uint LOD;
+    uint indexOffset;
+};
+
+layout(binding = 1) readonly buffer Vertices
+{
+    uint data[];
+} in_Vertices;
+
+layout(binding = 2) readonly buffer Indices
+{
+    uint data[];
+} in_Indices;
+
+layout(binding = 3) readonly buffer Instances
+{
+    InstanceData data[];
+} in_Instances;
+
+#include <shaders/VertexFormat.h>
+
+layout(binding = 5) readonly buffer VertexFormats
+{
+    VertexFormat data[];
+} in_Formats;
+
+uint vertexWord(uint i)
+{
+    return in_Vertices.data[i];
+}
+
+uint indexWord(uint i)
+{
+    return in_Indices.data[i];
+}
+
+void main()
+{
+    InstanceData instance = in_Instances.data[gl_BaseInstance];
+    VertexFormat fmt = in_Formats.data[instance.meshIndex];
+
+    uint idx = decodeIndex(fmt, instance.indexOffset + gl_VertexIndex);
+    vec3 pos = decodePosition(fmt, vertexAddress(fmt, idx));
+
+    gl_Position = ubo.mvp * instance.transform * vec4(pos, 1.0);
+    uvw = pos;
+    materialIndex = instance.materialIndex;
+}
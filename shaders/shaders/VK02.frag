@@ -5,7 +5,12 @@ layout( location = 1 ) in vec3 barycoords;
 layout( location = 2 ) in vec2 uv;
 layout( location = 0 ) out vec4 outColor;
 
+// set when the pipeline is created; with false the edge code is compiled out
+layout( constant_id = 0 ) const bool kWireframe = true;
+
+#ifdef TEXTURED
 layout( binding = 3 ) uniform sampler2D texSampler;
+#endif
 
 
 float edgeFactor(float thickness)
@@ -16,12 +21,19 @@ float edgeFactor(float thickness)
 
 void main()
 {
-    outColor = vec4(
-        mix(
+#ifdef TEXTURED
+    vec3 color = texture(texSampler, uv).xyz;
+#else
+    vec3 color = fragColor;
+#endif
+
+    if(kWireframe)
+    {
+        color = mix(
             vec3(0.0), // start range of mix interpolation
-            texture(texSampler, uv).xyz, // end range of mix interpolation
+            color, // end range of mix interpolation
             edgeFactor(1.0) // value to interpolate by
-        ), 
-        1.0
-    );
+        );
+    }
+    outColor = vec4(color, 1.0);
 }
\ No newline at end of file
@@ -8,16 +8,9 @@ layout(binding = 0) uniform UniformBuffer
     mat4 mvp;
 } ubo;
 
-struct VertexData
-{
-    float x, y, z;
-    float u, v;
-};
-
-
 layout(binding = 1) readonly buffer Vertices 
 { 
-    VertexData data[]; 
+    uint data[]; 
 } in_Vertices;
 
 layout(binding = 2) readonly buffer Indices
@@ -25,15 +18,32 @@ layout(binding = 2) readonly buffer Indices
     uint data[];
 } in_Indices;
 
+#include <shaders/VertexFormat.h>
+
+layout(binding = 4) readonly buffer VertexFormats
+{
+    VertexFormat data[];
+} in_Formats;
+
+uint vertexWord(uint i)
+{
+    return in_Vertices.data[i];
+}
+
+uint indexWord(uint i)
+{
+    return in_Indices.data[i];
+}
 
 void main()
 {
-    uint idx = in_Indices.data[gl_VertexIndex];
-    VertexData vtx = in_Vertices.data[idx];
+    // firstInstance of each draw is the mesh index
+    VertexFormat fmt = in_Formats.data[gl_BaseInstance];
 
-    vec3 pos = vec3(vtx.x, vtx.y, vtx.z);
+    uint idx = decodeIndex(fmt, gl_VertexIndex);
+    vec3 pos = decodePosition(fmt, vertexAddress(fmt, idx));
 
     gl_Position = ubo.mvp * vec4(pos, 1.0);
     fragColor = pos;
-    uv = vec2(vtx.u, vtx.z);
-}
\ No newline at end of file
+    uv = decodeTexCoord(fmt, attributeAddress(fmt, idx));
+}
@@ -0,0 +1,123 @@
+// Decoding of vertices and indices stored with the encodings of VertexFormat (see src/VtxData.h).
+// The including shader defines 'uint vertexWord(uint i)' and 'uint indexWord(uint i)',
+// returning the i-th 32-bit word of the vertex and index streams.
+
+#define VERTEX_ENCODING_NONE          0
+#define VERTEX_ENCODING_FLOAT32       1
+#define VERTEX_ENCODING_HALF          2
+#define VERTEX_ENCODING_UNORM16       3
+#define VERTEX_ENCODING_OCTAHEDRAL16  4
+
+// mirror of GPUVertexFormat
+struct VertexFormat
+{
+    vec4 positionOffset;
+    vec4 positionScale;
+    vec4 texCoordOffsetScale;
+    uint position;
+    uint texCoord;
+    uint normal;
+    // stride of the position stream in 32-bit words
+    uint stride;
+    // first word of the position stream of the mesh
+    uint vertexBase;
+    // size of one index in bytes, 2 or 4
+    uint indexSize;
+    // first word of the texCoord of vertex 0; points into the position stream for interleaved vertices
+    uint attributeBase;
+    // stride of the texCoord/normal stream in 32-bit words
+    uint attributeStride;
+};
+
+uint vertexWord(uint i);
+uint indexWord(uint i);
+
+// 'i' counts indices of fmt.indexSize bytes from the start of the index stream
+uint decodeIndex(VertexFormat fmt, uint i)
+{
+    if(fmt.indexSize == 2)
+    {
+        uint w = indexWord(i >> 1);
+        return ((i & 1) != 0) ? (w >> 16) : (w & 0xFFFF);
+    }
+    return indexWord(i);
+}
+
+// first word of the position of vertex 'idx' of the mesh
+uint vertexAddress(VertexFormat fmt, uint idx)
+{
+    return fmt.vertexBase + idx * fmt.stride;
+}
+
+// first word of the texCoord (or normal, without texCoords) of vertex 'idx';
+// the same code serves interleaved and split streams
+uint attributeAddress(VertexFormat fmt, uint idx)
+{
+    return fmt.attributeBase + idx * fmt.attributeStride;
+}
+
+uint attributeWords(uint encoding, uint components)
+{
+    if(encoding == VERTEX_ENCODING_FLOAT32) return components;
+    if(encoding == VERTEX_ENCODING_HALF || encoding == VERTEX_ENCODING_UNORM16) return (components + 1) / 2;
+    if(encoding == VERTEX_ENCODING_OCTAHEDRAL16) return 1;
+    return 0;
+}
+
+// 'base' is vertexAddress()
+vec3 decodePosition(VertexFormat fmt, uint base)
+{
+    if(fmt.position == VERTEX_ENCODING_FLOAT32)
+    {
+        return vec3(uintBitsToFloat(vertexWord(base)), uintBitsToFloat(vertexWord(base + 1)), uintBitsToFloat(vertexWord(base + 2)));
+    }
+    if(fmt.position == VERTEX_ENCODING_HALF)
+    {
+        return vec3(unpackHalf2x16(vertexWord(base)), unpackHalf2x16(vertexWord(base + 1)).x);
+    }
+    vec3 p = vec3(unpackUnorm2x16(vertexWord(base)), unpackUnorm2x16(vertexWord(base + 1)).x);
+    return fmt.positionOffset.xyz + p * fmt.positionScale.xyz;
+}
+
+// 'base' is attributeAddress()
+vec2 decodeTexCoord(VertexFormat fmt, uint base)
+{
+    uint w = base;
+    if(fmt.texCoord == VERTEX_ENCODING_FLOAT32)
+    {
+        return vec2(uintBitsToFloat(vertexWord(w)), uintBitsToFloat(vertexWord(w + 1)));
+    }
+    if(fmt.texCoord == VERTEX_ENCODING_HALF)
+    {
+        return unpackHalf2x16(vertexWord(w));
+    }
+    if(fmt.texCoord == VERTEX_ENCODING_UNORM16)
+    {
+        return fmt.texCoordOffsetScale.xy + unpackUnorm2x16(vertexWord(w)) * fmt.texCoordOffsetScale.zw;
+    }
+    return vec2(0.0);
+}
+
+// 'base' is attributeAddress()
+vec3 decodeNormal(VertexFormat fmt, uint base)
+{
+    uint w = base + attributeWords(fmt.texCoord, 2);
+    if(fmt.normal == VERTEX_ENCODING_FLOAT32)
+    {
+        return vec3(uintBitsToFloat(vertexWord(w)), uintBitsToFloat(vertexWord(w + 1)), uintBitsToFloat(vertexWord(w + 2)));
+    }
+    if(fmt.normal == VERTEX_ENCODING_HALF)
+    {
+        return normalize(vec3(unpackHalf2x16(vertexWord(w)), unpackHalf2x16(vertexWord(w + 1)).x));
+    }
+    if(fmt.normal == VERTEX_ENCODING_OCTAHEDRAL16)
+    {
+        // unfold the lower hemisphere, see encodeAttribute() in src/VtxData.cpp
+        vec2 e = unpackSnorm2x16(vertexWord(w));
+        vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+        float t = max(-n.z, 0.0);
+        n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+        return normalize(n);
+    }
+    return vec3(0.0, 0.0, 1.0);
+}
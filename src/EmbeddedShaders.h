@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* A descriptor an embedded shader uses, as reflectSPIRV() found it at build time */
+struct EmbeddedBinding
+{
+    uint32_t set;
+    uint32_t binding;
+    VkDescriptorType type;
+    uint32_t count;
+};
+
+/**
+ * A shader compiled to SPIR-V by tools/ShaderCompiler while building the application. Builds with
+ * BUILD_WITH_EMBEDDED_SHADERS take every shader from here and do not link glslang.
+ */
+struct EmbeddedShader
+{
+    // as passed to compileShaderFile(), "shaders/VK02.vert"
+    const char* fileName;
+    // shaderDefinesKey() of the variant, empty for the plain file
+    const char* defines;
+    VkShaderStageFlagBits stage;
+    const unsigned int* spirv;
+    size_t spirvSize;
+    const EmbeddedBinding* bindings;
+    size_t bindingCount;
+    // size 0 if the shader has no push constants
+    VkPushConstantRange pushConstants;
+};
+
+/* nullptr if this variant of 'fileName' was not compiled into the application */
+const EmbeddedShader* findEmbeddedShader(const char* fileName, const std::vector<std::string>& defines = {});
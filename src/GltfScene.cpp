@@ -0,0 +1,328 @@
+#include "GltfScene.h"
+#include "UtilsMappedFile.h"
+
+#define CGLTF_IMPLEMENTATION
+#include <cgltf.h>
+
+#include <glm/ext.hpp>
+
+#include <ctype.h>
+#include <string.h>
+#include <filesystem>
+#include <string>
+
+
+static const cgltf_attribute_type kAttributeTypes[eGltfAttribute_Count] =
+{
+    cgltf_attribute_type_position,
+    cgltf_attribute_type_normal,
+    cgltf_attribute_type_texcoord
+};
+
+static const cgltf_type kAttributeShapes[eGltfAttribute_Count] = { cgltf_type_vec3, cgltf_type_vec3, cgltf_type_vec2 };
+
+bool isGltfFile(const char* fileName)
+{
+    std::string ext = std::filesystem::path(fileName).extension().string();
+    for(char& c : ext) { c = static_cast<char>(tolower(c)); }
+    return ext == ".gltf" || ext == ".glb";
+}
+
+/* Set 0 of an attribute, nullptr if the primitive does not have it */
+static const cgltf_accessor* findAttribute(const cgltf_primitive* primitive, eGltfAttribute attribute)
+{
+    for(cgltf_size i = 0; i != primitive->attributes_count; i++)
+    {
+        const cgltf_attribute& a = primitive->attributes[i];
+        if(a.type == kAttributeTypes[attribute] && a.index == 0) { return a.data; }
+    }
+    return nullptr;
+}
+
+/* First element of an accessor inside the mapped buffer; nullptr for accessors without a buffer view (all zeros) */
+static const uint8_t* accessorData(const cgltf_accessor* accessor)
+{
+    const cgltf_buffer_view* view = accessor->buffer_view;
+    return view ? static_cast<const uint8_t*>(view->buffer->data) + view->offset + accessor->offset : nullptr;
+}
+
+template<typename Fn>
+static void forEachIndex(const cgltf_accessor* accessor, Fn&& fn)
+{
+    const uint8_t* src = accessorData(accessor);
+    if(src && accessor->component_type == cgltf_component_type_r_32u)
+    {
+        for(cgltf_size i = 0; i != accessor->count; i++)
+        {
+            uint32_t idx;
+            memcpy(&idx, src + i * accessor->stride, sizeof(idx));
+            fn(i, idx);
+        }
+    }
+    else if(src && accessor->component_type == cgltf_component_type_r_16u)
+    {
+        for(cgltf_size i = 0; i != accessor->count; i++)
+        {
+            uint16_t idx;
+            memcpy(&idx, src + i * accessor->stride, sizeof(idx));
+            fn(i, idx);
+        }
+    }
+    else
+    {
+        for(cgltf_size i = 0; i != accessor->count; i++)
+        {
+            fn(i, static_cast<uint32_t>(cgltf_accessor_read_index(accessor, i)));
+        }
+    }
+}
+
+GltfScene::~GltfScene()
+{
+    release();
+}
+
+void GltfScene::release()
+{
+    if(m_data)
+    {
+        // the buffers point into our mappings, cgltf must not free them
+        for(cgltf_size i = 0; i != m_data->buffers_count; i++)
+        {
+            m_data->buffers[i].data = nullptr;
+        }
+        cgltf_free(m_data);
+        m_data = nullptr;
+    }
+    for(const Mapping& mapping : m_mappings)
+    {
+        unmapFile(mapping.ptr, mapping.size);
+    }
+    m_mappings.clear();
+    m_primitives.clear();
+    m_instances.clear();
+    m_materialCount = 0;
+}
+
+bool GltfScene::fail(const char* error)
+{
+    release();
+    m_error = error;
+    return false;
+}
+
+/* Path of an external buffer next to the glTF file; false for data URIs and percent-encoded URIs */
+static bool bufferPath(const std::filesystem::path& baseDir, const char* uri, std::string& path)
+{
+    if(strncmp(uri, "data:", 5) == 0 || strchr(uri, '%')) { return false; }
+    path = (baseDir / uri).string();
+    return true;
+}
+
+bool GltfScene::getBufferFiles(const char* fileName, std::vector<std::string>& files)
+{
+    cgltf_data* data = nullptr;
+    const cgltf_options options = {};
+    if(cgltf_parse_file(&options, fileName, &data) != cgltf_result_success) { return false; }
+
+    const std::filesystem::path baseDir = std::filesystem::path(fileName).parent_path();
+    files.clear();
+    for(cgltf_size i = 0; i != data->buffers_count; i++)
+    {
+        std::string path;
+        if(data->buffers[i].uri && bufferPath(baseDir, data->buffers[i].uri, path)) { files.push_back(path); }
+    }
+    cgltf_free(data);
+    return true;
+}
+
+bool GltfScene::mapBuffers(const char* fileName)
+{
+    const std::filesystem::path baseDir = std::filesystem::path(fileName).parent_path();
+
+    for(cgltf_size i = 0; i != m_data->buffers_count; i++)
+    {
+        cgltf_buffer& buffer = m_data->buffers[i];
+        if(!buffer.uri)
+        {
+            // the BIN chunk of a .glb, which lies inside the mapping of the file itself
+            if(i != 0 || !m_data->bin || m_data->bin_size < buffer.size) { return false; }
+            buffer.data = const_cast<void*>(m_data->bin);
+            continue;
+        }
+        std::string path;
+        if(!bufferPath(baseDir, buffer.uri, path)) { return false; }
+
+        Mapping mapping = {};
+        mapping.ptr = mapFileReadOnly(path.c_str(), &mapping.size);
+        if(!mapping.ptr) { return false; }
+        m_mappings.push_back(mapping);
+
+        if(mapping.size < buffer.size) { return false; }
+        buffer.data = mapping.ptr;
+    }
+    return true;
+}
+
+void GltfScene::addNodeInstances(const cgltf_node* node, const glm::mat4& parentTransform, const std::vector<uint32_t>& meshPrimitiveBase)
+{
+    // column-major, like glm
+    float local[16];
+    cgltf_node_transform_local(node, local);
+    const glm::mat4 transform = parentTransform * glm::make_mat4(local);
+
+    if(node->mesh)
+    {
+        const size_t meshIndex = node->mesh - m_data->meshes;
+        for(cgltf_size i = 0; i != node->mesh->primitives_count; i++)
+        {
+            m_instances.push_back(Instance{ .primitiveIndex = meshPrimitiveBase[meshIndex] + static_cast<uint32_t>(i), .transform = transform });
+        }
+    }
+    for(cgltf_size i = 0; i != node->children_count; i++)
+    {
+        addNodeInstances(node->children[i], transform, meshPrimitiveBase);
+    }
+}
+
+bool GltfScene::load(const char* fileName)
+{
+    release();
+    m_error = "";
+
+    Mapping file = {};
+    file.ptr = mapFileReadOnly(fileName, &file.size);
+    if(!file.ptr) { return fail("cannot map the file"); }
+    m_mappings.push_back(file);
+
+    // .gltf or .glb, told apart by the magic value; the JSON and the BIN chunk stay in the mapping
+    const cgltf_options options = {};
+    if(cgltf_parse(&options, file.ptr, file.size, &m_data) != cgltf_result_success) { return fail("cannot parse the file"); }
+    if(cgltf_validate(m_data) != cgltf_result_success) { return fail("invalid glTF"); }
+    if(m_data->extensions_required_count) { return fail("requires extensions"); }
+    if(!mapBuffers(fileName)) { return fail("embedded or missing buffers"); }
+
+    std::vector<uint32_t> meshPrimitiveBase(m_data->meshes_count);
+    bool bDefaultMaterial = false;
+
+    for(cgltf_size m = 0; m != m_data->meshes_count; m++)
+    {
+        const cgltf_mesh& mesh = m_data->meshes[m];
+        meshPrimitiveBase[m] = static_cast<uint32_t>(m_primitives.size());
+
+        for(cgltf_size i = 0; i != mesh.primitives_count; i++)
+        {
+            const cgltf_primitive& primitive = mesh.primitives[i];
+            if(primitive.type != cgltf_primitive_type_triangles) { return fail("non-triangle primitives"); }
+
+            const cgltf_accessor* positions = findAttribute(&primitive, eGltfAttribute_Position);
+            if(!positions) { return fail("primitives without positions"); }
+
+            for(uint32_t a = 0; a != eGltfAttribute_Count; a++)
+            {
+                const cgltf_accessor* accessor = findAttribute(&primitive, static_cast<eGltfAttribute>(a));
+                if(!accessor) { continue; }
+                if(accessor->is_sparse) { return fail("sparse accessors"); }
+                if(accessor->type != kAttributeShapes[a] || accessor->count != positions->count) { return fail("unexpected attribute layout"); }
+            }
+
+            const uint32_t vertexCount = static_cast<uint32_t>(positions->count);
+            if(primitive.indices)
+            {
+                if(primitive.indices->is_sparse || (primitive.indices->count % 3) != 0) { return fail("unexpected index layout"); }
+
+                // out of range indices would be read by the mesh optimizer as vertices
+                bool bInRange = true;
+                forEachIndex(primitive.indices, [&](cgltf_size, uint32_t idx) { bInRange = bInRange && idx < vertexCount; });
+                if(!bInRange) { return fail("indices out of range"); }
+            }
+            else if((vertexCount % 3) != 0)
+            {
+                return fail("unexpected index layout");
+            }
+
+            bDefaultMaterial = bDefaultMaterial || !primitive.material;
+            const uint32_t materialIndex = primitive.material ?
+                static_cast<uint32_t>(primitive.material - m_data->materials) : static_cast<uint32_t>(m_data->materials_count);
+
+            m_primitives.push_back(Primitive{ .primitive = &primitive, .materialIndex = materialIndex, .vertexCount = vertexCount });
+        }
+    }
+    m_materialCount = static_cast<uint32_t>(m_data->materials_count) + (bDefaultMaterial ? 1 : 0);
+
+    const cgltf_scene* scene = m_data->scene ? m_data->scene : (m_data->scenes_count ? m_data->scenes : nullptr);
+    if(scene)
+    {
+        for(cgltf_size i = 0; i != scene->nodes_count; i++)
+        {
+            addNodeInstances(scene->nodes[i], glm::mat4(1.0f), meshPrimitiveBase);
+        }
+    }
+    else
+    {
+        for(cgltf_size i = 0; i != m_data->nodes_count; i++)
+        {
+            if(!m_data->nodes[i].parent) { addNodeInstances(&m_data->nodes[i], glm::mat4(1.0f), meshPrimitiveBase); }
+        }
+    }
+
+    return true;
+}
+
+bool GltfScene::hasAttribute(const Primitive& p, eGltfAttribute attribute)
+{
+    return findAttribute(p.primitive, attribute) != nullptr;
+}
+
+bool GltfScene::readAttribute(const Primitive& p, eGltfAttribute attribute, float* dst, size_t dstStride)
+{
+    const cgltf_accessor* accessor = findAttribute(p.primitive, attribute);
+    if(!accessor) { return false; }
+
+    const size_t components = cgltf_num_components(accessor->type);
+    const uint8_t* src = accessorData(accessor);
+
+    if(!src)
+    {
+        for(size_t i = 0; i != p.vertexCount; i++)
+        {
+            memset(dst + i * dstStride, 0, components * sizeof(float));
+        }
+    }
+    else if(accessor->component_type == cgltf_component_type_r_32f)
+    {
+        // already in the format the converter works on: plain copies out of the mapping
+        for(size_t i = 0; i != p.vertexCount; i++)
+        {
+            memcpy(dst + i * dstStride, src + i * accessor->stride, components * sizeof(float));
+        }
+    }
+    else
+    {
+        for(size_t i = 0; i != p.vertexCount; i++)
+        {
+            cgltf_accessor_read_float(accessor, i, dst + i * dstStride, components);
+        }
+    }
+    return true;
+}
+
+void GltfScene::readIndices(const Primitive& p, std::vector<uint32_t>& indices)
+{
+    const cgltf_accessor* accessor = p.primitive->indices;
+    if(!accessor)
+    {
+        indices.resize(p.vertexCount);
+        for(uint32_t i = 0; i != p.vertexCount; i++) { indices[i] = i; }
+        return;
+    }
+
+    indices.resize(accessor->count);
+    const uint8_t* src = accessorData(accessor);
+    if(src && accessor->component_type == cgltf_component_type_r_32u && accessor->stride == sizeof(uint32_t))
+    {
+        memcpy(indices.data(), src, indices.size() * sizeof(uint32_t));
+        return;
+    }
+    forEachIndex(accessor, [&](cgltf_size i, uint32_t idx) { indices[i] = idx; });
+}
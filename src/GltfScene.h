@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct cgltf_data;
+struct cgltf_node;
+struct cgltf_primitive;
+
+enum eGltfAttribute : uint32_t
+{
+    eGltfAttribute_Position = 0,
+    eGltfAttribute_Normal,
+    eGltfAttribute_TexCoord,
+    eGltfAttribute_Count
+};
+
+/**
+ * Reads glTF 2.0 files (.gltf with external buffers, or .glb) without assimp. The JSON is parsed with cgltf,
+ * buffers are memory mapped and accessors are read straight from the mappings: float attributes are copied as they
+ * are, without any per-vertex conversion, and nothing else is built in between.
+ * load() fails for files the fast path does not cover (data URIs, required extensions such as Draco or meshopt
+ * compression, sparse accessors, non-triangle primitives); callers import those with assimp instead.
+ */
+class GltfScene
+{
+public:
+
+    /* A triangle list primitive of a glTF mesh */
+    struct Primitive
+    {
+        const cgltf_primitive* primitive;
+        uint32_t materialIndex;
+        uint32_t vertexCount;
+    };
+
+    /* A primitive placed by a node of the scene, with the world transform of the node */
+    struct Instance
+    {
+        uint32_t primitiveIndex;
+        glm::mat4 transform;
+    };
+
+    GltfScene() = default;
+    ~GltfScene();
+
+    GltfScene(const GltfScene&) = delete;
+    GltfScene& operator=(const GltfScene&) = delete;
+
+    /* False if the file cannot be read or needs assimp, see getError() */
+    bool load(const char* fileName);
+
+    void release();
+
+    /* Why the last load() failed */
+    inline const char* getError() const { return m_error; }
+
+    /* Primitives of all meshes, in mesh order */
+    inline const std::vector<Primitive>& getPrimitives() const { return m_primitives; }
+
+    /* Placements of the default scene (all root nodes if there is none), in node order */
+    inline const std::vector<Instance>& getInstances() const { return m_instances; }
+
+    /* Materials referenced by Primitive::materialIndex; primitives without one use the index after the last material */
+    inline uint32_t getMaterialCount() const { return m_materialCount; }
+
+    static bool hasAttribute(const Primitive& p, eGltfAttribute attribute);
+
+    /**
+     * Writes the attribute of every vertex to 'dst', 'dstStride' floats apart: 3 floats for positions and normals,
+     * 2 for texture coordinates. Normalized integer attributes are converted. False if the primitive lacks it.
+     */
+    static bool readAttribute(const Primitive& p, eGltfAttribute attribute, float* dst, size_t dstStride);
+
+    /* Triangle list indices; a primitive without indices gets 0..vertexCount-1 */
+    static void readIndices(const Primitive& p, std::vector<uint32_t>& indices);
+
+    /* Paths of the external buffers of 'fileName', resolved like load() does; false if the file cannot be parsed */
+    static bool getBufferFiles(const char* fileName, std::vector<std::string>& files);
+
+private:
+
+    bool fail(const char* error);
+
+    bool mapBuffers(const char* fileName);
+
+    void addNodeInstances(const cgltf_node* node, const glm::mat4& parentTransform, const std::vector<uint32_t>& meshPrimitiveBase);
+
+    cgltf_data* m_data = nullptr;
+    const char* m_error = "";
+
+    /* the file itself and the external buffers it references */
+    struct Mapping
+    {
+        void* ptr;
+        size_t size;
+    };
+    std::vector<Mapping> m_mappings;
+
+    std::vector<Primitive> m_primitives;
+    std::vector<Instance> m_instances;
+    uint32_t m_materialCount = 0;
+};
+
+/* True for .gltf and .glb file names */
+bool isGltfFile(const char* fileName);
@@ -1,133 +1,1044 @@
 #include "MeshConvert.h"
+#include "UtilsHash.h"
+#include "UtilsThreadPool.h"
 
 #include <assimp/postprocess.h>
 #include <assimp/cimport.h>
 
+#include <meshoptimizer.h>
 
-bool verbose = true;
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
 
-std::vector<Mesh> m_meshes;
-std::vector<uint32_t> m_indexData;
-std::vector<float> m_vertexData;
-// MeshData m_meshData;
-
-uint32_t m_indexOffset = 0;
-uint32_t m_vertexOffset = 0;
-bool bExportTextures = false;
-bool bExportNormals = false;
 
 constexpr uint32_t m_numElementsToStore = 3;
 
 // float m_meshScale = 0.01f;
-// bool m_bCalculateLODs = false;
 
-Mesh convertAIMesh(const aiMesh *m)
+MeshConverter::MeshConverter(const MeshConvertOptions& options, ThreadPool* pool) :
+    m_options(options),
+    m_pool(pool)
+{
+}
+
+void MeshConverter::reset()
+{
+    m_meshData = MeshData();
+    m_optStats = OptimizationStats();
+    m_geometryIndex.clear();
+    m_materialBase = 0;
+}
+
+uint32_t MeshConverter::vertexElementCount() const
+{
+    return m_numElementsToStore + (m_options.exportTextures ? 2 : 0) + (m_options.exportNormals ? 3 : 0);
+}
+
+VertexFormat MeshConverter::exportVertexFormat() const
+{
+    return VertexFormat
+    {
+        .position = m_options.positionEncoding,
+        .texCoord = m_options.exportTextures ? m_options.texCoordEncoding : eVertexEncoding_None,
+        .normal = m_options.exportNormals ? m_options.normalEncoding : eVertexEncoding_None,
+        .layout = m_options.vertexLayout
+    };
+}
+
+void MeshConverter::forEach(size_t count, const std::function<void(size_t)>& fn) const
+{
+    if(m_pool)
+    {
+        m_pool->parallelFor(count, fn);
+        return;
+    }
+    for(size_t i = 0; i != count; i++)
+    {
+        fn(i);
+    }
+}
+
+/**
+ * Reorders indices for post-transform cache reuse, then triangles for less overdraw,
+ * then vertices for fetch locality. Positions have to be the first three floats of a vertex.
+ */
+void MeshConverter::optimizeMesh(std::vector<uint32_t>& indices, std::vector<float>& vertices, uint32_t numElements, OptimizationStats& stats) const
+{
+    const size_t vertexSize = numElements * sizeof(float);
+    const size_t vertexCount = vertices.size() / numElements;
+
+    const meshopt_VertexCacheStatistics before = meshopt_analyzeVertexCache(indices.data(), indices.size(), vertexCount, m_options.statsCacheSize, 0, 0);
+
+    meshopt_optimizeVertexCache(indices.data(), indices.data(), indices.size(), vertexCount);
+    meshopt_optimizeOverdraw(indices.data(), indices.data(), indices.size(), vertices.data(), vertexCount, vertexSize, m_options.overdrawThreshold);
+
+    std::vector<float> fetchOrdered(vertices.size());
+    const size_t uniqueVertices = meshopt_optimizeVertexFetch(fetchOrdered.data(), indices.data(), indices.size(), vertices.data(), vertexCount, vertexSize);
+    fetchOrdered.resize(uniqueVertices * numElements);
+    vertices.swap(fetchOrdered);
+
+    const meshopt_VertexCacheStatistics after = meshopt_analyzeVertexCache(indices.data(), indices.size(), uniqueVertices, m_options.statsCacheSize, 0, 0);
+
+    stats.triangles += indices.size() / 3;
+    stats.verticesBefore += vertexCount;
+    stats.verticesAfter += uniqueVertices;
+    stats.transformedBefore += before.vertices_transformed;
+    stats.transformedAfter += after.vertices_transformed;
+}
+
+/**
+ * Appends simplified index buffers to 'outLods' (which holds LOD 0 on entry) until kMaxLODs is reached
+ * or the simplifier cannot meet the next target within lodMaxError.
+ */
+void MeshConverter::processLODs(std::vector<std::vector<uint32_t>>& outLods, std::vector<float>& outErrors, const std::vector<float>& vertices, uint32_t numElements) const
+{
+    const size_t vertexSize = numElements * sizeof(float);
+    const size_t vertexCount = vertices.size() / numElements;
+    const std::vector<uint32_t>& srcIndices = outLods[0];
+
+    // converts the relative error reported by the simplifier into object space units
+    const float errorScale = meshopt_simplifyScale(vertices.data(), vertexCount, vertexSize);
+
+    size_t targetIndexCount = srcIndices.size();
+
+    while(outLods.size() < kMaxLODs)
+    {
+        targetIndexCount = static_cast<size_t>(targetIndexCount * m_options.lodTargetRatio) / 3 * 3;
+        if(targetIndexCount < m_options.lodMinTriangles * 3) { break; }
+
+        std::vector<uint32_t> lod(srcIndices.size());
+        float resultError = 0.0f;
+        // always simplify from LOD 0 so errors do not accumulate along the chain
+        lod.resize(meshopt_simplify(
+            lod.data(), srcIndices.data(), srcIndices.size(),
+            vertices.data(), vertexCount, vertexSize,
+            targetIndexCount, m_options.lodMaxError, &resultError));
+
+        // the error limit was hit before the target: further levels would not get any smaller
+        if(lod.size() >= outLods.back().size() || lod.empty()) { break; }
+
+        if(m_options.optimize)
+        {
+            meshopt_optimizeVertexCache(lod.data(), lod.data(), lod.size(), vertexCount);
+        }
+
+        outLods.push_back(std::move(lod));
+        outErrors.push_back(resultError * errorScale);
+    }
+}
+
+/**
+ * Splits 'indices' into meshlets with their culling bounds.
+ * Triangles of every meshlet start at a 4-byte boundary of the triangle table.
+ */
+void MeshConverter::processMeshlets(ConvertedMesh& out, const std::vector<uint32_t>& indices, const std::vector<float>& vertices, uint32_t numElements) const
+{
+    const size_t vertexSize = numElements * sizeof(float);
+    const size_t vertexCount = vertices.size() / numElements;
+
+    const size_t maxMeshlets = meshopt_buildMeshletsBound(indices.size(), kMaxMeshletVertices, kMaxMeshletTriangles);
+    std::vector<meshopt_Meshlet> meshlets(maxMeshlets);
+    std::vector<uint32_t> meshletVertices(maxMeshlets * kMaxMeshletVertices);
+    std::vector<uint8_t> meshletTriangles(maxMeshlets * kMaxMeshletTriangles * 3);
+
+    meshlets.resize(meshopt_buildMeshlets(
+        meshlets.data(), meshletVertices.data(), meshletTriangles.data(),
+        indices.data(), indices.size(),
+        vertices.data(), vertexCount, vertexSize,
+        kMaxMeshletVertices, kMaxMeshletTriangles, m_options.meshletConeWeight));
+
+    out.mesh.meshletCount = static_cast<uint32_t>(meshlets.size());
+    out.meshlets.reserve(meshlets.size());
+
+    for(const meshopt_Meshlet& src : meshlets)
+    {
+        const meshopt_Bounds bounds = meshopt_computeMeshletBounds(
+            &meshletVertices[src.vertex_offset], &meshletTriangles[src.triangle_offset], src.triangle_count,
+            vertices.data(), vertexCount, vertexSize);
+
+        Meshlet meshlet =
+        {
+            .vertexOffset = static_cast<uint32_t>(out.meshletVertices.size()),
+            .triangleOffset = static_cast<uint32_t>(out.meshletTriangles.size()),
+            .vertexCount = src.vertex_count,
+            .triangleCount = src.triangle_count,
+            .center = { bounds.center[0], bounds.center[1], bounds.center[2] },
+            .radius = bounds.radius,
+            .coneAxis = { bounds.cone_axis[0], bounds.cone_axis[1], bounds.cone_axis[2] },
+            .coneCutoff = bounds.cone_cutoff,
+            .coneApex = { bounds.cone_apex[0], bounds.cone_apex[1], bounds.cone_apex[2] },
+            .padding = 0.0f
+        };
+        out.meshlets.push_back(meshlet);
+
+        out.meshletVertices.insert(
+            out.meshletVertices.end(),
+            meshletVertices.begin() + src.vertex_offset, meshletVertices.begin() + src.vertex_offset + src.vertex_count);
+
+        const size_t triangleBytes = src.triangle_count * 3;
+        out.meshletTriangles.insert(
+            out.meshletTriangles.end(),
+            meshletTriangles.begin() + src.triangle_offset, meshletTriangles.begin() + src.triangle_offset + triangleBytes);
+        out.meshletTriangles.resize((out.meshletTriangles.size() + 3) & ~size_t(3));
+    }
+}
+
+MeshConverter::ConvertedMesh MeshConverter::convertAIMesh(const aiMesh *m) const
 {
     // Check whether the original mesh has texture coordinates
     const bool hasTexCoords = m->HasTextureCoords(0);
 
     const uint32_t numIndices = m->mNumFaces * 3;
-    const uint32_t numElements = m_numElementsToStore;
-
-    const uint32_t streamElementSize = static_cast<uint32_t>(numElements * sizeof(float));
-    const uint32_t meshSize = static_cast<uint32_t>(m->mNumVertices * streamElementSize + numIndices * sizeof(uint32_t));
-
-    const Mesh result = 
-    { 
-        .lodCount = 1, 
-        .streamCount = 1, 
-        .materialID = 0, 
-        .meshSize = meshSize, 
-        .vertexCount = m->mNumVertices,
-        .lodOffset = {
-            static_cast<uint32_t>(m_indexOffset * sizeof(uint32_t)),
-            static_cast<uint32_t>((m_indexOffset + numIndices) * sizeof(uint32_t))
-        },
-        .streamOffset = {
-            m_vertexOffset * streamElementSize
-        },
-        .streamElementSize = { streamElementSize }
-    };
+    const uint32_t numElements = vertexElementCount();
+
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    vertices.reserve(m->mNumVertices * numElements);
+    indices.reserve(numIndices);
 
     for(size_t i = 0; i != m->mNumVertices; i++)
     {
         const aiVector3D& v = m->mVertices[i];
         const aiVector3D& n = m->mNormals[i];
         const aiVector3D& t = hasTexCoords ? m->mTextureCoords[0][i] : aiVector3D();
-        
-        m_vertexData.push_back(v.x);
-        m_vertexData.push_back(v.y);
-        m_vertexData.push_back(v.z);
-        
-        if(bExportTextures)
+
+        vertices.push_back(v.x);
+        vertices.push_back(v.y);
+        vertices.push_back(v.z);
+
+        if(m_options.exportTextures)
         {
-            m_vertexData.push_back(t.x);
-            m_vertexData.push_back(t.y);
+            vertices.push_back(t.x);
+            vertices.push_back(t.y);
         }
 
-        if(bExportNormals)
+        if(m_options.exportNormals)
         {
-            m_vertexData.push_back(n.x);
-            m_vertexData.push_back(n.y);
-            m_vertexData.push_back(n.z);
+            vertices.push_back(n.x);
+            vertices.push_back(n.y);
+            vertices.push_back(n.z);
         }
     }
 
     for(size_t i = 0; i != m->mNumFaces; i++)
     {
         const aiFace& F = m->mFaces[i];
-        m_indexData.push_back(F.mIndices[0] + m_vertexOffset);
-        m_indexData.push_back(F.mIndices[1] + m_vertexOffset);
-        m_indexData.push_back(F.mIndices[2] + m_vertexOffset);
+        indices.push_back(F.mIndices[0]);
+        indices.push_back(F.mIndices[1]);
+        indices.push_back(F.mIndices[2]);
     }
 
-    m_indexOffset += numIndices;
-    m_vertexOffset += m->mNumVertices;
+    ConvertedMesh out = convertMesh(vertices, indices);
+    out.mesh.materialID = m_materialBase + m->mMaterialIndex;
+    return out;
+}
 
-    return result;
+MeshConverter::ConvertedMesh MeshConverter::convertGltfMesh(const GltfScene& gltf, size_t i) const
+{
+    // pre-transformed meshes are one per placement, like with aiProcess_PreTransformVertices
+    const GltfScene::Instance* instance = m_options.keepInstances ? nullptr : &gltf.getInstances()[i];
+    const GltfScene::Primitive& primitive = gltf.getPrimitives()[instance ? instance->primitiveIndex : i];
+
+    const uint32_t numElements = vertexElementCount();
+    const uint32_t texCoordOffset = m_numElementsToStore;
+    const uint32_t normalOffset = m_numElementsToStore + (m_options.exportTextures ? 2 : 0);
+
+    // attributes go straight from the mapped buffers into their slots; missing texture coordinates stay 0
+    std::vector<float> vertices(size_t(primitive.vertexCount) * numElements);
+    GltfScene::readAttribute(primitive, eGltfAttribute_Position, vertices.data(), numElements);
+    if(m_options.exportTextures)
+    {
+        GltfScene::readAttribute(primitive, eGltfAttribute_TexCoord, vertices.data() + texCoordOffset, numElements);
+    }
+    if(m_options.exportNormals)
+    {
+        GltfScene::readAttribute(primitive, eGltfAttribute_Normal, vertices.data() + normalOffset, numElements);
+    }
+
+    if(instance)
+    {
+        const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(instance->transform)));
+        for(size_t v = 0; v != primitive.vertexCount; v++)
+        {
+            float* vertex = vertices.data() + v * numElements;
+            const glm::vec4 p = instance->transform * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f);
+            vertex[0] = p.x;
+            vertex[1] = p.y;
+            vertex[2] = p.z;
+
+            if(m_options.exportNormals)
+            {
+                float* normal = vertex + normalOffset;
+                const glm::vec3 n = glm::normalize(normalMatrix * glm::vec3(normal[0], normal[1], normal[2]));
+                normal[0] = n.x;
+                normal[1] = n.y;
+                normal[2] = n.z;
+            }
+        }
+    }
+
+    std::vector<uint32_t> indices;
+    GltfScene::readIndices(primitive, indices);
+
+    ConvertedMesh out = convertMesh(vertices, indices);
+    out.mesh.materialID = m_materialBase + primitive.materialIndex;
+    return out;
+}
+
+MeshConverter::ConvertedMesh MeshConverter::convertMesh(std::vector<float>& vertices, std::vector<uint32_t>& indices) const
+{
+    ConvertedMesh out;
+    const uint32_t numElements = vertexElementCount();
+
+    if(m_options.optimize)
+    {
+        optimizeMesh(indices, vertices, numElements, out.stats);
+    }
+
+    const uint32_t vertexCount = static_cast<uint32_t>(vertices.size() / numElements);
+
+    // optimization and simplification work on floats, quantization happens when the vertices are stored
+    VertexFormat vertexFormat = exportVertexFormat();
+    computeVertexFormatRanges(vertexFormat, vertices.data(), vertexCount);
+    const uint32_t vertexSize = vertexFormatStride(vertexFormat);
+    const uint32_t streamCount = vertexFormatStreamCount(vertexFormat);
+
+    std::vector<std::vector<uint32_t>> lods;
+    std::vector<float> lodErrors = { 0.0f };
+    lods.push_back(std::move(indices));
+
+    if(m_options.calculateLODs)
+    {
+        processLODs(lods, lodErrors, vertices, numElements);
+    }
+
+    // indices are local to the mesh, so 16 bits are enough for most meshes and all their LODs
+    const uint32_t indexSize = (vertexCount <= 0x10000) ? sizeof(uint16_t) : sizeof(uint32_t);
+
+    out.mesh =
+    {
+        .lodCount = static_cast<uint32_t>(lods.size()),
+        .streamCount = streamCount,
+        .materialID = 0,
+        .meshSize = 0,
+        .vertexCount = vertexCount,
+        .indexSize = indexSize,
+        .lodOffset = {},
+        .lodError = {},
+        .streamOffset = { 0, (streamCount == 2) ? uint64_t(vertexCount) * vertexFormatStreamStride(vertexFormat, 0) : 0 },
+        .streamElementSize = { vertexFormatStreamStride(vertexFormat, 0), vertexFormatStreamStride(vertexFormat, 1) },
+        .vertexFormat = vertexFormat
+    };
+
+    if(m_options.generateMeshlets)
+    {
+        processMeshlets(out, lods[0], vertices, numElements);
+    }
+
+    // from the float vertices: quantized positions would inflate the bounds by up to half a step
+    out.bounds.reserve(lods.size());
+    for(const std::vector<uint32_t>& lod : lods)
+    {
+        out.bounds.push_back(computeMeshBounds(vertices.data(), numElements, lod.data(), lod.size()));
+    }
+
+    size_t totalIndices = 0;
+    for(const std::vector<uint32_t>& lod : lods)
+    {
+        totalIndices += lod.size();
+    }
+    // the next mesh may use a different index size and has to start at a 4-byte boundary
+    const size_t indexDataSize = totalIndices * indexSize;
+    out.indexData.resize((indexDataSize + 3) & ~size_t(3));
+
+    uint8_t* dst = out.indexData.data();
+    for(size_t l = 0; l != lods.size(); l++)
+    {
+        out.mesh.lodOffset[l] = static_cast<uint32_t>(dst - out.indexData.data());
+        out.mesh.lodError[l] = lodErrors[l];
+
+        for(uint32_t idx : lods[l])
+        {
+            if(indexSize == sizeof(uint16_t))
+            {
+                const uint16_t idx16 = static_cast<uint16_t>(idx);
+                memcpy(dst, &idx16, sizeof(idx16));
+            }
+            else
+            {
+                memcpy(dst, &idx, sizeof(idx));
+            }
+            dst += indexSize;
+        }
+    }
+    out.mesh.lodOffset[lods.size()] = static_cast<uint32_t>(indexDataSize);
+    out.mesh.meshSize = static_cast<uint32_t>(vertexCount * vertexSize + indexDataSize);
+
+    out.vertexData.resize(size_t(vertexCount) * vertexSize);
+    encodeVertices(vertexFormat, vertices.data(), vertexCount, out.vertexData.data());
+
+    return out;
 }
 
+/* A mesh and the vertex and index bytes it owns; offsets in 'mesh' are relative to the first of them */
+struct GeometryRef
+{
+    const Mesh& mesh;
+    std::span<const uint8_t> vertices;
+    std::span<const uint8_t> indices;
+};
+
+static bool sameGeometry(const GeometryRef& a, const GeometryRef& b)
+{
+    if(a.mesh.vertexCount != b.mesh.vertexCount || a.mesh.indexSize != b.mesh.indexSize ||
+       a.mesh.lodCount != b.mesh.lodCount || a.mesh.streamCount != b.mesh.streamCount ||
+       memcmp(&a.mesh.vertexFormat, &b.mesh.vertexFormat, sizeof(VertexFormat)) != 0 ||
+       a.vertices.size() != b.vertices.size() || a.indices.size() != b.indices.size())
+    {
+        return false;
+    }
+    for(uint32_t l = 0; l <= a.mesh.lodCount; l++)
+    {
+        if(a.mesh.lodOffset[l] - a.mesh.lodOffset[0] != b.mesh.lodOffset[l] - b.mesh.lodOffset[0]) { return false; }
+    }
+    for(uint32_t s = 0; s != a.mesh.streamCount; s++)
+    {
+        if(a.mesh.streamOffset[s] - a.mesh.streamOffset[0] != b.mesh.streamOffset[s] - b.mesh.streamOffset[0]) { return false; }
+    }
+    return
+        memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size()) == 0 &&
+        memcmp(a.indices.data(), b.indices.data(), a.indices.size()) == 0;
+}
 
-bool loadFile(const char *fileName)
+/**
+ * Finds meshes whose geometry is already in m_meshData or earlier in 'converted'. Duplicates are removed from
+ * 'converted'; the result holds the index in m_meshData.meshes each input mesh ends up with.
+ */
+std::vector<uint32_t> MeshConverter::resolveDuplicates(std::vector<ConvertedMesh>& converted)
 {
-    if(verbose) printf("Loading '%s'...\n", fileName);
+    const uint32_t firstMesh = static_cast<uint32_t>(m_meshData.meshes.size());
+    std::vector<uint32_t> meshIndices(converted.size());
+    for(size_t i = 0; i != converted.size(); i++)
+    {
+        meshIndices[i] = firstMesh + static_cast<uint32_t>(i);
+    }
+    if(!m_options.deduplicate) { return meshIndices; }
+
+    std::vector<uint64_t> hashes(converted.size());
+    forEach(converted.size(), [&](size_t i)
+    {
+        const ConvertedMesh& c = converted[i];
+        uint64_t h = hashBytes(c.vertexData.data(), c.vertexData.size());
+        h = hashCombine(h, hashBytes(c.indexData.data(), c.indexData.size()));
+        hashes[i] = hashCombine(h, hashBytes(&c.mesh.vertexFormat, sizeof(VertexFormat)));
+    });
+
+    const auto storedGeometry = [&](uint32_t meshIndex)
+    {
+        const Mesh& mesh = m_meshData.meshes[meshIndex];
+        const size_t indexBytes = (size_t(mesh.lodOffset[mesh.lodCount] - mesh.lodOffset[0]) + 3) & ~size_t(3);
+        return GeometryRef
+        {
+            .mesh = mesh,
+            .vertices = std::span<const uint8_t>(m_meshData.vertexData).subspan(mesh.streamOffset[0], size_t(mesh.vertexCount) * vertexFormatStride(mesh.vertexFormat)),
+            .indices = std::span<const uint8_t>(m_meshData.indexData).subspan(mesh.lodOffset[0], indexBytes)
+        };
+    };
+    const auto convertedGeometry = [](const ConvertedMesh& c)
+    {
+        return GeometryRef{ .mesh = c.mesh, .vertices = c.vertexData, .indices = c.indexData };
+    };
+
+    // positions in 'converted' of the meshes that are kept
+    std::vector<size_t> unique;
+    for(size_t i = 0; i != converted.size(); i++)
+    {
+        const GeometryRef geometry = convertedGeometry(converted[i]);
+        uint32_t meshIndex = ~0u;
+
+        const auto range = m_geometryIndex.equal_range(hashes[i]);
+        for(auto it = range.first; it != range.second && meshIndex == ~0u; ++it)
+        {
+            const uint32_t candidate = it->second;
+            const bool bSame = (candidate < firstMesh) ?
+                sameGeometry(geometry, storedGeometry(candidate)) :
+                sameGeometry(geometry, convertedGeometry(converted[unique[candidate - firstMesh]]));
+            if(bSame) { meshIndex = candidate; }
+        }
+
+        if(meshIndex == ~0u)
+        {
+            meshIndex = firstMesh + static_cast<uint32_t>(unique.size());
+            unique.push_back(i);
+            m_geometryIndex.emplace(hashes[i], meshIndex);
+        }
+        meshIndices[i] = meshIndex;
+    }
+
+    for(size_t u = 0; u != unique.size(); u++)
+    {
+        if(unique[u] != u) { converted[u] = std::move(converted[unique[u]]); }
+    }
+    converted.resize(unique.size());
+
+    if(m_options.verbose && unique.size() != meshIndices.size())
+    {
+        printf("Deduplicated %zu of %zu meshes\n", meshIndices.size() - unique.size(), meshIndices.size());
+    }
+    return meshIndices;
+}
+
+/**
+ * Moves converted meshes to the end of m_meshData. Offsets of every mesh come from a prefix sum
+ * over the buffer sizes, so the copies are independent and run in parallel.
+ */
+std::vector<uint32_t> MeshConverter::appendMeshes(std::vector<ConvertedMesh>& converted)
+{
+    for(const ConvertedMesh& c : converted)
+    {
+        accumulateStats(c.stats);
+    }
+
+    const std::vector<uint32_t> meshIndices = resolveDuplicates(converted);
+
+    struct Offsets
+    {
+        size_t index = 0;
+        size_t vertex = 0;
+        size_t meshlet = 0;
+        size_t meshletVertex = 0;
+        size_t meshletTriangle = 0;
+        size_t bounds = 0;
+    };
+
+    std::vector<Offsets> offsets(converted.size() + 1);
+    offsets[0] = Offsets
+    {
+        .index = m_meshData.indexData.size(),
+        .vertex = m_meshData.vertexData.size(),
+        .meshlet = m_meshData.meshlets.size(),
+        .meshletVertex = m_meshData.meshletVertices.size(),
+        .meshletTriangle = m_meshData.meshletTriangles.size(),
+        .bounds = m_meshData.bounds.size()
+    };
+    for(size_t i = 0; i != converted.size(); i++)
+    {
+        const ConvertedMesh& c = converted[i];
+        offsets[i + 1] = Offsets
+        {
+            .index = offsets[i].index + c.indexData.size(),
+            .vertex = offsets[i].vertex + c.vertexData.size(),
+            .meshlet = offsets[i].meshlet + c.meshlets.size(),
+            .meshletVertex = offsets[i].meshletVertex + c.meshletVertices.size(),
+            .meshletTriangle = offsets[i].meshletTriangle + c.meshletTriangles.size(),
+            .bounds = offsets[i].bounds + c.bounds.size()
+        };
+    }
+
+    const Offsets& end = offsets.back();
+    const size_t firstMesh = m_meshData.meshes.size();
+    m_meshData.meshes.resize(firstMesh + converted.size());
+    m_meshData.boxes.resize(firstMesh + converted.size());
+    m_meshData.bounds.resize(end.bounds);
+    m_meshData.indexData.resize(end.index);
+    m_meshData.vertexData.resize(end.vertex);
+    m_meshData.meshlets.resize(end.meshlet);
+    m_meshData.meshletVertices.resize(end.meshletVertex);
+    m_meshData.meshletTriangles.resize(end.meshletTriangle);
+
+    forEach(converted.size(), [&](size_t i)
+    {
+        ConvertedMesh& c = converted[i];
+        const Offsets& o = offsets[i];
+
+        Mesh& mesh = c.mesh;
+        for(uint32_t l = 0; l <= mesh.lodCount; l++)
+        {
+            mesh.lodOffset[l] += static_cast<uint32_t>(o.index);
+        }
+        for(uint32_t s = 0; s != mesh.streamCount; s++)
+        {
+            mesh.streamOffset[s] += o.vertex;
+        }
+        mesh.meshletOffset = static_cast<uint32_t>(o.meshlet);
+        mesh.boundsOffset = static_cast<uint32_t>(o.bounds);
+
+        for(Meshlet& meshlet : c.meshlets)
+        {
+            meshlet.vertexOffset += static_cast<uint32_t>(o.meshletVertex);
+            meshlet.triangleOffset += static_cast<uint32_t>(o.meshletTriangle);
+        }
+
+        m_meshData.meshes[firstMesh + i] = mesh;
+        m_meshData.boxes[firstMesh + i] = getBoundingBox(c.bounds[0]);
+        std::copy(c.bounds.begin(), c.bounds.end(), m_meshData.bounds.begin() + o.bounds);
+        std::copy(c.indexData.begin(), c.indexData.end(), m_meshData.indexData.begin() + o.index);
+        std::copy(c.vertexData.begin(), c.vertexData.end(), m_meshData.vertexData.begin() + o.vertex);
+        std::copy(c.meshlets.begin(), c.meshlets.end(), m_meshData.meshlets.begin() + o.meshlet);
+        std::copy(c.meshletVertices.begin(), c.meshletVertices.end(), m_meshData.meshletVertices.begin() + o.meshletVertex);
+        std::copy(c.meshletTriangles.begin(), c.meshletTriangles.end(), m_meshData.meshletTriangles.begin() + o.meshletTriangle);
+
+        c = ConvertedMesh();
+    });
+
+    return meshIndices;
+}
+
+void MeshConverter::addInstance(uint32_t meshIndex, uint32_t materialIndex, const glm::mat4& transform)
+{
+    const Mesh& mesh = m_meshData.meshes[meshIndex];
+    InstanceData instance =
+    {
+        .transform = {},
+        .meshIndex = meshIndex,
+        .materialIndex = materialIndex,
+        .LOD = 0,
+        .m_indexOffset = mesh.lodOffset[0] / mesh.indexSize
+    };
+    memcpy(instance.transform, glm::value_ptr(transform), sizeof(instance.transform));
+    m_meshData.instances.push_back(instance);
+}
+
+void MeshConverter::addNodeInstances(const aiScene* scene, const aiNode* node, const glm::mat4& parentTransform, const std::vector<uint32_t>& meshIndices)
+{
+    // aiMatrix4x4 is row-major
+    const glm::mat4 transform = parentTransform * glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+
+    for(uint32_t i = 0; i != node->mNumMeshes; i++)
+    {
+        const uint32_t sceneMesh = node->mMeshes[i];
+        addInstance(meshIndices[sceneMesh], m_materialBase + scene->mMeshes[sceneMesh]->mMaterialIndex, transform);
+    }
+    for(uint32_t i = 0; i != node->mNumChildren; i++)
+    {
+        addNodeInstances(scene, node->mChildren[i], transform, meshIndices);
+    }
+}
+
+void MeshConverter::addScene(const aiScene* scene)
+{
+    std::vector<ConvertedMesh> converted(scene->mNumMeshes);
+    forEach(scene->mNumMeshes, [&](size_t i)
+    {
+        converted[i] = convertAIMesh(scene->mMeshes[i]);
+    });
+
+    addSceneInstances(scene, appendMeshes(converted));
+}
+
+void MeshConverter::addSceneInstances(const aiScene* scene, const std::vector<uint32_t>& meshIndices)
+{
+    if(m_options.keepInstances && scene->mRootNode)
+    {
+        addNodeInstances(scene, scene->mRootNode, glm::mat4(1.0f), meshIndices);
+    }
+    else
+    {
+        // pre-transformed meshes sit at the origin
+        for(uint32_t i = 0; i != scene->mNumMeshes; i++)
+        {
+            addInstance(meshIndices[i], m_materialBase + scene->mMeshes[i]->mMaterialIndex, glm::mat4(1.0f));
+        }
+    }
+
+    m_materialBase += scene->mNumMaterials;
+}
+
+size_t MeshConverter::gltfMeshCount(const GltfScene& gltf) const
+{
+    return m_options.keepInstances ? gltf.getPrimitives().size() : gltf.getInstances().size();
+}
+
+void MeshConverter::addGltfScene(const GltfScene& gltf)
+{
+    std::vector<ConvertedMesh> converted(gltfMeshCount(gltf));
+    forEach(converted.size(), [&](size_t i)
+    {
+        converted[i] = convertGltfMesh(gltf, i);
+    });
+
+    addGltfInstances(gltf, appendMeshes(converted));
+}
+
+void MeshConverter::addGltfInstances(const GltfScene& gltf, const std::vector<uint32_t>& meshIndices)
+{
+    const std::vector<GltfScene::Primitive>& primitives = gltf.getPrimitives();
+    const std::vector<GltfScene::Instance>& instances = gltf.getInstances();
+    for(size_t i = 0; i != instances.size(); i++)
+    {
+        const GltfScene::Instance& instance = instances[i];
+        const uint32_t materialIndex = m_materialBase + primitives[instance.primitiveIndex].materialIndex;
+        if(m_options.keepInstances)
+        {
+            addInstance(meshIndices[instance.primitiveIndex], materialIndex, instance.transform);
+        }
+        else
+        {
+            addInstance(meshIndices[i], materialIndex, glm::mat4(1.0f));
+        }
+    }
+
+    m_materialBase += gltf.getMaterialCount();
+}
+
+void MeshConverter::accumulateStats(const OptimizationStats& stats)
+{
+    m_optStats.triangles += stats.triangles;
+    m_optStats.verticesBefore += stats.verticesBefore;
+    m_optStats.verticesAfter += stats.verticesAfter;
+    m_optStats.transformedBefore += stats.transformedBefore;
+    m_optStats.transformedAfter += stats.transformedAfter;
+}
+
+const aiScene* MeshConverter::importScene(const char* fileName) const
+{
+    if(m_options.verbose) printf("Loading '%s'...\n", fileName);
     const unsigned int flags =
         aiProcess_JoinIdenticalVertices |
         aiProcess_Triangulate |
         aiProcess_GenSmoothNormals |
-        aiProcess_PreTransformVertices |
+        // Vulkan has the texture origin at the top left
+        aiProcess_FlipUVs |
+        (m_options.keepInstances ? 0 : aiProcess_PreTransformVertices) |
         aiProcess_RemoveRedundantMaterials |
         aiProcess_FindDegenerates |
         aiProcess_FindInvalidData |
         aiProcess_FindInstances |
         aiProcess_OptimizeMeshes;
-    
+
     const aiScene* scene = aiImportFile(fileName, flags);
     if(!scene || !scene->HasMeshes())
     {
         printf("Unable to load '%s'\n", fileName);
+        if(scene) aiReleaseImport(scene);
+        return nullptr;
+    }
+
+    return scene;
+}
+
+void MeshConverter::printStats(const char* fileName, size_t meshletCount, size_t meshletVertexCount) const
+{
+    if(m_options.verbose && m_options.optimize && m_optStats.triangles > 0)
+    {
+        printf("'%s' vertex cache (size %u): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+            fileName,
+            m_options.statsCacheSize,
+            double(m_optStats.transformedBefore) / double(m_optStats.triangles),
+            double(m_optStats.transformedAfter) / double(m_optStats.triangles),
+            double(m_optStats.transformedBefore) / double(m_optStats.verticesBefore),
+            double(m_optStats.transformedAfter) / double(m_optStats.verticesAfter));
+    }
+
+    if(m_options.verbose && m_options.generateMeshlets)
+    {
+        printf("'%s' meshlets: %zu (%zu vertex references)\n", fileName, meshletCount, meshletVertexCount);
+    }
+}
+
+bool MeshConverter::loadGltfScene(const char* fileName, GltfScene& gltf) const
+{
+    if(!m_options.gltfFastPath || !isGltfFile(fileName)) { return false; }
+
+    const char* reason = gltf.load(fileName) ? nullptr : gltf.getError();
+    if(!reason && m_options.exportNormals)
+    {
+        // assimp generates missing normals
+        for(const GltfScene::Primitive& primitive : gltf.getPrimitives())
+        {
+            if(!GltfScene::hasAttribute(primitive, eGltfAttribute_Normal)) { reason = "primitives without normals"; }
+        }
+    }
+
+    if(reason)
+    {
+        if(m_options.verbose) printf("'%s' is not supported by the glTF fast path (%s), importing it with assimp\n", fileName, reason);
+        gltf.release();
         return false;
     }
 
-    m_meshes.reserve(scene->mNumMeshes);
-    for(size_t i = 0; i != scene->mNumMeshes; i++)
+    if(m_options.verbose) printf("Loading '%s' (glTF fast path)...\n", fileName);
+    return true;
+}
+
+bool MeshConverter::loadFile(const char *fileName)
+{
+    GltfScene gltf;
+    if(loadGltfScene(fileName, gltf))
     {
-        m_meshes.push_back(convertAIMesh(scene->mMeshes[i]));
+        addGltfScene(gltf);
+        printStats(fileName, m_meshData.meshlets.size(), m_meshData.meshletVertices.size());
+        return true;
     }
+
+    const aiScene* scene = importScene(fileName);
+    if(!scene) { return false; }
+
+    addScene(scene);
+    printStats(fileName, m_meshData.meshlets.size(), m_meshData.meshletVertices.size());
+
+    aiReleaseImport(scene);
     return true;
 }
 
-void saveMeshToFile(FILE *f)
+bool MeshConverter::streamFile(const char* fileName, const char* meshFile, uint64_t sourceKey)
 {
-    const MeshFileHeader header =
+    // the file holds only the meshes of 'fileName', in scene order
+    const auto fileMeshIndices = [](size_t count)
     {
-        .magicValue = 0x12345678,
-        .meshCount = (uint32_t)m_meshes.size(),
-        .dataBlockStartOffset = (uint32_t)(sizeof(MeshFileHeader) + m_meshes.size() * sizeof(Mesh)),
-        .indexDataSize = static_cast<uint32_t>(m_indexData.size() * sizeof(uint32_t)),
-        .vertexDataSize = static_cast<uint32_t>(m_vertexData.size() * sizeof(float))
+        std::vector<uint32_t> indices(count);
+        for(size_t i = 0; i != count; i++) { indices[i] = static_cast<uint32_t>(i); }
+        return indices;
     };
 
-    fwrite(&header, 1, sizeof(header), f);
-    fwrite(m_meshes.data(), header.meshCount, sizeof(Mesh), f);
+    GltfScene gltf;
+    if(loadGltfScene(fileName, gltf))
+    {
+        const size_t meshCount = gltfMeshCount(gltf);
+        if(!writeMeshes(fileName, meshFile, sourceKey, meshCount, [&](size_t i) { return convertGltfMesh(gltf, i); })) { return false; }
+        addGltfInstances(gltf, fileMeshIndices(meshCount));
+        return true;
+    }
+
+    const aiScene* scene = importScene(fileName);
+    if(!scene) { return false; }
+
+    const bool result = writeMeshes(fileName, meshFile, sourceKey, scene->mNumMeshes, [&](size_t i) { return convertAIMesh(scene->mMeshes[i]); });
+    if(result) { addSceneInstances(scene, fileMeshIndices(scene->mNumMeshes)); }
+
+    aiReleaseImport(scene);
+    return result;
+}
+
+bool MeshConverter::writeMeshes(const char* fileName, const char* meshFile, uint64_t sourceKey, size_t meshCount, const std::function<ConvertedMesh(size_t)>& convert)
+{
+    MeshFileWriter writer;
+    bool result = writer.open(meshFile, static_cast<uint32_t>(meshCount), m_options.indexCodec, m_options.vertexCodec, sourceKey);
+
+    const size_t batchSize = m_pool ? m_pool->getNumThreads() : 1;
+    std::vector<ConvertedMesh> converted(batchSize);
+    size_t meshletCount = 0;
+    size_t meshletVertexCount = 0;
+
+    for(size_t first = 0; result && first < meshCount; first += batchSize)
+    {
+        const size_t count = std::min<size_t>(batchSize, meshCount - first);
+        forEach(count, [&](size_t i)
+        {
+            converted[i] = convert(first + i);
+        });
+
+        // written in scene order, so the file matches loadFile() + saveMeshData()
+        for(size_t i = 0; i != count; i++)
+        {
+            ConvertedMesh& c = converted[i];
+            accumulateStats(c.stats);
+            meshletCount += c.meshlets.size();
+            meshletVertexCount += c.meshletVertices.size();
+
+            result = result && writer.addMesh(c.mesh, c.bounds, c.indexData, c.vertexData, c.meshlets, c.meshletVertices, c.meshletTriangles);
+            c = ConvertedMesh();
+        }
+    }
+
+    // instances point into the mesh table of this file
+    m_meshData.meshes = writer.getMeshes();
+    m_meshData.instances.clear();
+
+    result = result && writer.close();
+    if(result) printStats(fileName, meshletCount, meshletVertexCount);
+
+    return result;
+}
+
+bool MeshConverter::saveMeshData(const char* fileName, uint64_t sourceKey) const
+{
+    return ::saveMeshData(fileName, m_meshData, m_options.indexCodec, m_options.vertexCodec, sourceKey);
+}
+
+bool MeshConverter::saveInstanceData(const char* fileName) const
+{
+    std::vector<InstanceData> instances = m_meshData.instances;
+    sortInstances(instances);
+    return ::saveInstanceData(fileName, instances);
+}
+
+static uint64_t hashFloat(uint64_t seed, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return hashCombine(seed, bits);
+}
+
+uint64_t meshConvertOptionsHash(const MeshConvertOptions& options)
+{
+    // field by field: padding bytes of the struct are indeterminate
+    uint64_t h = kMeshFileVersion;
+    h = hashCombine(h, options.exportTextures);
+    h = hashCombine(h, options.exportNormals);
+    h = hashCombine(h, options.optimize);
+    h = hashFloat(h, options.overdrawThreshold);
+    h = hashCombine(h, options.calculateLODs);
+    h = hashFloat(h, options.lodTargetRatio);
+    h = hashFloat(h, options.lodMaxError);
+    h = hashCombine(h, options.lodMinTriangles);
+    h = hashCombine(h, options.positionEncoding);
+    h = hashCombine(h, options.texCoordEncoding);
+    h = hashCombine(h, options.normalEncoding);
+    h = hashCombine(h, options.vertexLayout);
+    h = hashCombine(h, options.generateMeshlets);
+    h = hashFloat(h, options.meshletConeWeight);
+    h = hashCombine(h, options.keepInstances);
+    h = hashCombine(h, options.deduplicate);
+    h = hashCombine(h, options.indexCodec);
+    h = hashCombine(h, options.vertexCodec);
+    h = hashCombine(h, options.gltfFastPath);
+    return h;
+}
+
+/* Hash of the contents of a file, read in fixed-size chunks; false if it cannot be read */
+static bool hashFileContents(const char* fileName, uint64_t& h)
+{
+    FILE* f = fopen(fileName, "rb");
+    if(!f) { return false; }
+
+    HashStream hash;
+    std::vector<uint8_t> chunk(1 << 20);
+    size_t numRead;
+    while((numRead = fread(chunk.data(), 1, chunk.size(), f)) != 0)
+    {
+        hash.update(chunk.data(), numRead);
+    }
+    const bool result = !ferror(f);
+    fclose(f);
+
+    if(result) { h = hash.digest(); }
+    return result;
+}
+
+/* The 'mtllib' files of an OBJ file, next to it like assimp looks them up */
+static void findMaterialLibraries(const char* objFile, std::vector<std::string>& files)
+{
+    FILE* f = fopen(objFile, "r");
+    if(!f) { return; }
+
+    const std::filesystem::path baseDir = std::filesystem::path(objFile).parent_path();
+    char line[1024];
+    while(fgets(line, sizeof(line), f))
+    {
+        if(strncmp(line, "mtllib", 6) != 0 || !isspace(static_cast<unsigned char>(line[6]))) { continue; }
+
+        std::string name = line + 7;
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t\r\n") + 1);
+        if(!name.empty()) { files.push_back((baseDir / name).string()); }
+    }
+    fclose(f);
+}
+
+uint64_t meshConvertSourceKey(const char* srcFile, const MeshConvertOptions& options)
+{
+    uint64_t key;
+    if(!hashFileContents(srcFile, key)) { return 0; }
+
+    // external .bin buffers and .mtl files change the output as much as the file itself
+    std::vector<std::string> references;
+    std::string ext = std::filesystem::path(srcFile).extension().string();
+    for(char& c : ext) { c = static_cast<char>(tolower(c)); }
+    if(isGltfFile(srcFile))
+    {
+        GltfScene::getBufferFiles(srcFile, references);
+    }
+    else if(ext == ".obj")
+    {
+        findMaterialLibraries(srcFile, references);
+    }
+    for(const std::string& file : references)
+    {
+        // a missing file hashes differently from an empty one, so creating it later invalidates the key
+        uint64_t h;
+        key = hashCombine(key, hashFileContents(file.c_str(), h) ? hashCombine(h, 1) : 0);
+    }
+
+    key = hashCombine(key, meshConvertOptionsHash(options));
+    // 0 is reserved for files without a key
+    return key ? key : 1;
+}
+
+bool replaceConvertedFiles(std::span<const std::string> files, bool bWritten)
+{
+    namespace fs = std::filesystem;
+
+    std::error_code ec;
+    for(size_t i = 0; i != files.size() && bWritten; i++)
+    {
+        const std::string tmpFile = files[i] + ".tmp";
+        fs::rename(tmpFile, files[i], ec);
+        if(ec)
+        {
+            printf("Cannot rename '%s' to '%s'\n", tmpFile.c_str(), files[i].c_str());
+            bWritten = false;
+        }
+    }
+    if(!bWritten)
+    {
+        for(const std::string& file : files)
+        {
+            fs::remove(file + ".tmp", ec);
+        }
+    }
+    return bWritten;
+}
+
+bool convertMeshFile(const char* srcFile, const char* meshFile, const MeshConvertOptions& options, ThreadPool* pool, uint64_t sourceKey)
+{
+    // everything is written next to its destination and renamed at the end, so a crash never leaves a half written
+    // file or a new instance list next to an old mesh file behind
+    const std::string tmpFile = std::string(meshFile) + ".tmp";
+    const std::string instanceFile = std::string(meshFile) + ".instances";
+
+    MeshConverter converter(options, pool);
+    bool result = options.streaming ?
+        converter.streamFile(srcFile, tmpFile.c_str(), sourceKey) :
+        converter.loadFile(srcFile) && converter.saveMeshData(tmpFile.c_str(), sourceKey);
+    // meshes are in object space, their placement lives in the instances
+    result = result && (!options.keepInstances || converter.saveInstanceData((instanceFile + ".tmp").c_str()));
+
+    std::vector<std::string> files;
+    if(options.keepInstances) { files.push_back(instanceFile); }
+    files.push_back(meshFile);
+    if(!replaceConvertedFiles(files, result)) { return false; }
+
+    if(options.verbose) printf("Converted '%s' to '%s'\n", srcFile, meshFile);
+    return true;
+}
+
+bool convertMeshFileIfStale(const char* srcFile, const char* meshFile, const MeshConvertOptions& options, ThreadPool* pool)
+{
+    // the key covers the source, the files it references and the options, so timestamps do not matter;
+    // files written before a layout change fail to read and are converted again
+    const uint64_t sourceKey = meshConvertSourceKey(srcFile, options);
+    MeshFileHeader header;
+    if(sourceKey && readMeshFileHeader(meshFile, header) && header.sourceKey == sourceKey) { return true; }
+
+    return convertMeshFile(srcFile, meshFile, options, pool, sourceKey);
+}
+
+uint32_t convertMeshFilesIfStale(std::span<const MeshConvertJob> jobs, const MeshConvertOptions& options, ThreadPool& pool)
+{
+    std::atomic<uint32_t> numFailed = 0;
+
+    // files and the meshes inside them share the pool, so a few large files do not leave threads idle
+    pool.parallelFor(jobs.size(), [&](size_t i)
+    {
+        if(!convertMeshFileIfStale(jobs[i].srcFile.c_str(), jobs[i].meshFile.c_str(), options, &pool))
+        {
+            numFailed++;
+        }
+    });
+
+    return numFailed;
 }
@@ -1,11 +1,235 @@
 #pragma once
 
 #include "VtxData.h"
+#include "GltfScene.h"
 #include <assimp/scene.h>
 
+#include <functional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
-Mesh convertAIMesh(const aiMesh* m);
+class ThreadPool;
 
-bool loadFile(const char* fileName);
+struct MeshConvertOptions final
+{
+    bool exportTextures = false;
+    bool exportNormals = false;
 
-void saveMeshToFile(FILE* f);
\ No newline at end of file
+    // Optional optimization stage: vertex cache, overdraw and vertex fetch reordering
+    bool optimize = false;
+    // Maximum allowed ACMR degradation when reordering triangles for overdraw (1.05 = 5%)
+    float overdrawThreshold = 1.05f;
+    // FIFO cache size used for the ACMR/ATVR report
+    uint32_t statsCacheSize = 16;
+
+    // Optional LOD chain generation with quadric edge collapse
+    bool calculateLODs = false;
+    // Index count of each LOD relative to the previous one
+    float lodTargetRatio = 0.5f;
+    // Largest accepted simplification error, relative to the mesh extents
+    float lodMaxError = 0.02f;
+    // Stop simplifying below this many triangles
+    uint32_t lodMinTriangles = 32;
+
+    // Encoding of the exported vertex attributes, see eVertexEncoding
+    uint32_t positionEncoding = eVertexEncoding_Float32;
+    uint32_t texCoordEncoding = eVertexEncoding_Float32;
+    uint32_t normalEncoding = eVertexEncoding_Float32;
+    // Distribution of the attributes over vertex streams, see eVertexLayout
+    uint32_t vertexLayout = eVertexLayout_Interleaved;
+
+    // Optional meshlet generation for cluster culling, from LOD 0
+    bool generateMeshlets = false;
+    // Trades meshlet compactness for tighter normal cones; 0 ignores the cones
+    float meshletConeWeight = 0.25f;
+
+    // Keep the node hierarchy as one InstanceData per node mesh instead of baking transforms into the vertices
+    // (aiProcess_PreTransformVertices); meshes stay in object space and are stored once however often they are placed
+    bool keepInstances = false;
+
+    // Store meshes with identical geometry once, also across loadFile() calls; instances keep referencing every source mesh
+    bool deduplicate = false;
+
+    // Index and vertex block encodings of the written file, see eIndexCodec and eVertexCodec
+    uint32_t indexCodec = eIndexCodec_None;
+    uint32_t vertexCodec = eVertexCodec_None;
+
+    // Read .gltf/.glb files directly from their mapped buffers instead of through assimp; files the fast path does not
+    // cover still go through assimp. Meshes are taken as they are stored, without assimp's vertex welding and cleanup
+    bool gltfFastPath = true;
+
+    // convertMeshFile() writes every mesh as soon as it is converted instead of building the whole MeshData first.
+    // The output is identical, so this is not part of meshConvertOptionsHash()
+    bool streaming = false;
+
+    bool verbose = true;
+
+    /* Unorm16 positions and texCoords, Octahedral16 normals */
+    inline void setQuantized()
+    {
+        positionEncoding = eVertexEncoding_Unorm16;
+        texCoordEncoding = eVertexEncoding_Unorm16;
+        normalEncoding = eVertexEncoding_Octahedral16;
+    }
+};
+
+/**
+ * Converts assimp scenes into MeshData. All state lives in the object, so any number of converters
+ * can run at the same time. With a thread pool the meshes of a scene are converted in parallel
+ * into separate buffers, which are then concatenated at offsets from a prefix sum.
+ */
+class MeshConverter
+{
+public:
+
+    explicit MeshConverter(const MeshConvertOptions& options, ThreadPool* pool = nullptr);
+
+    /* Appends all meshes of 'fileName' */
+    bool loadFile(const char* fileName);
+
+    /* Appends all meshes of an already imported scene */
+    void addScene(const aiScene* scene);
+
+    /* 'sourceKey' is stored in the header, see meshConvertSourceKey() */
+    bool saveMeshData(const char* fileName, uint64_t sourceKey = 0) const;
+
+    /* MeshData::instances sorted into material batches, see sortInstances() */
+    bool saveInstanceData(const char* fileName) const;
+
+    /**
+     * Converts 'fileName' straight into 'meshFile' with a MeshFileWriter, one batch of meshes (one per thread)
+     * at a time. Besides the imported scene only the batch in flight is held in memory. getMeshData() only gets the
+     * mesh table of 'meshFile' and the instances, for saveInstanceData(); meshes are not deduplicated.
+     */
+    bool streamFile(const char* fileName, const char* meshFile, uint64_t sourceKey = 0);
+
+    inline const MeshData& getMeshData() const { return m_meshData; }
+
+    void reset();
+
+private:
+
+    struct OptimizationStats
+    {
+        uint64_t triangles = 0;
+        uint64_t verticesBefore = 0;
+        uint64_t verticesAfter = 0;
+        uint64_t transformedBefore = 0;
+        uint64_t transformedAfter = 0;
+    };
+
+    /* Output of one aiMesh; offsets in 'mesh' and 'meshlets' are relative to these buffers */
+    struct ConvertedMesh
+    {
+        Mesh mesh;
+        std::vector<MeshBounds> bounds;
+        std::vector<uint8_t> indexData;
+        std::vector<uint8_t> vertexData;
+        std::vector<Meshlet> meshlets;
+        std::vector<uint32_t> meshletVertices;
+        std::vector<uint8_t> meshletTriangles;
+        OptimizationStats stats;
+    };
+
+    ConvertedMesh convertAIMesh(const aiMesh* m) const;
+
+    /* Mesh 'i' of gltfMeshCount(): a primitive with keepInstances, otherwise an instance with its transform applied */
+    ConvertedMesh convertGltfMesh(const GltfScene& gltf, size_t i) const;
+
+    /* Optimizes, simplifies, splits and encodes unencoded vertices (vertexElementCount() floats each) */
+    ConvertedMesh convertMesh(std::vector<float>& vertices, std::vector<uint32_t>& indices) const;
+
+    void optimizeMesh(std::vector<uint32_t>& indices, std::vector<float>& vertices, uint32_t numElements, OptimizationStats& stats) const;
+
+    void processLODs(std::vector<std::vector<uint32_t>>& outLods, std::vector<float>& outErrors, const std::vector<float>& vertices, uint32_t numElements) const;
+
+    void processMeshlets(ConvertedMesh& out, const std::vector<uint32_t>& indices, const std::vector<float>& vertices, uint32_t numElements) const;
+
+    /* Returns the index in m_meshData.meshes of every converted mesh */
+    std::vector<uint32_t> appendMeshes(std::vector<ConvertedMesh>& converted);
+
+    void addNodeInstances(const aiScene* scene, const aiNode* node, const glm::mat4& parentTransform, const std::vector<uint32_t>& meshIndices);
+
+    /* Instances of every node mesh of 'scene', whose meshes are meshIndices[] in m_meshData.meshes */
+    void addSceneInstances(const aiScene* scene, const std::vector<uint32_t>& meshIndices);
+
+    void addInstance(uint32_t meshIndex, uint32_t materialIndex, const glm::mat4& transform);
+
+    /* Loads 'fileName' if it is a glTF file the fast path covers; false means it has to be imported with assimp */
+    bool loadGltfScene(const char* fileName, GltfScene& gltf) const;
+
+    size_t gltfMeshCount(const GltfScene& gltf) const;
+
+    void addGltfScene(const GltfScene& gltf);
+
+    /* Same as addSceneInstances(), meshIndices[] indexed like gltfMeshCount() */
+    void addGltfInstances(const GltfScene& gltf, const std::vector<uint32_t>& meshIndices);
+
+    /* Converts 'meshCount' meshes one batch at a time and writes them to 'meshFile' with a MeshFileWriter; m_meshData.meshes becomes its mesh table */
+    bool writeMeshes(const char* fileName, const char* meshFile, uint64_t sourceKey, size_t meshCount, const std::function<ConvertedMesh(size_t)>& convert);
+
+    std::vector<uint32_t> resolveDuplicates(std::vector<ConvertedMesh>& converted);
+
+    void accumulateStats(const OptimizationStats& stats);
+
+    void printStats(const char* fileName, size_t meshletCount, size_t meshletVertexCount) const;
+
+    const aiScene* importScene(const char* fileName) const;
+
+    uint32_t vertexElementCount() const;
+
+    VertexFormat exportVertexFormat() const;
+
+    void forEach(size_t count, const std::function<void(size_t)>& fn) const;
+
+    MeshConvertOptions m_options;
+    ThreadPool* m_pool = nullptr;
+
+    MeshData m_meshData;
+    OptimizationStats m_optStats;
+
+    // material indices of every scene start after those of the scenes added before
+    uint32_t m_materialBase = 0;
+
+    // geometry hash -> index in m_meshData.meshes, for MeshConvertOptions::deduplicate
+    std::unordered_multimap<uint64_t, uint32_t> m_geometryIndex;
+};
+
+/* Hash of every option that changes the converted output */
+uint64_t meshConvertOptionsHash(const MeshConvertOptions& options);
+
+/**
+ * Cache key of a conversion: hash of the contents of 'srcFile', of the files it references (external glTF buffers,
+ * OBJ material libraries) and of meshConvertOptionsHash(). Returns 0 when 'srcFile' cannot be read.
+ */
+uint64_t meshConvertSourceKey(const char* srcFile, const MeshConvertOptions& options);
+
+/**
+ * Moves every '<file>.tmp' over '<file>', in order, once all of them were written ('bWritten'); on any failure the
+ * temporary files are removed instead. Put the mesh file last: it carries the source key, so a commit cut short
+ * leaves it stale and the next run converts it again.
+ */
+bool replaceConvertedFiles(std::span<const std::string> files, bool bWritten);
+
+/**
+ * Converts 'srcFile' into 'meshFile' unconditionally. The files are written next to their destination and renamed,
+ * so readers never see a partial file. With MeshConvertOptions::keepInstances the instances go to '<meshFile>.instances'.
+ */
+bool convertMeshFile(const char* srcFile, const char* meshFile, const MeshConvertOptions& options, ThreadPool* pool = nullptr, uint64_t sourceKey = 0);
+
+/**
+ * Converts 'srcFile' into 'meshFile' unless 'meshFile' has the current layout version and its header stores the
+ * meshConvertSourceKey() of 'srcFile' and 'options'.
+ */
+bool convertMeshFileIfStale(const char* srcFile, const char* meshFile, const MeshConvertOptions& options, ThreadPool* pool = nullptr);
+
+struct MeshConvertJob
+{
+    std::string srcFile;
+    std::string meshFile;
+};
+
+/* Runs convertMeshFileIfStale() for all jobs on 'pool'; returns the number of failed jobs */
+uint32_t convertMeshFilesIfStale(std::span<const MeshConvertJob> jobs, const MeshConvertOptions& options, ThreadPool& pool);
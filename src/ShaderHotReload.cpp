@@ -0,0 +1,243 @@
+#include "ShaderHotReload.h"
+#include "VKShader.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// editors save in several steps (truncate, write, rename); changes this close together are handled as one
+constexpr const int kSettleMilliseconds = 50;
+
+ShaderHotReload::ShaderHotReload(VulkanRenderDevice &vkDev) :
+    m_vkDev(vkDev)
+{
+#if defined(__linux__)
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(m_inotify < 0)
+    {
+        printf("ShaderHotReload: inotify is not available, shaders will not be reloaded\n");
+        return;
+    }
+#endif
+    m_watcher = std::thread([this]() { watcherLoop(); });
+}
+
+ShaderHotReload::~ShaderHotReload()
+{
+    bStopping = true;
+    if(m_watcher.joinable()) { m_watcher.join(); }
+
+#if defined(__linux__)
+    if(m_inotify >= 0) { close(m_inotify); }
+#endif
+
+    for(const auto& [renderer, pipeline] : m_readyPipelines)
+    {
+        vkDestroyPipeline(m_vkDev.device, pipeline, nullptr);
+    }
+}
+
+void ShaderHotReload::addRenderer(VulkanRendererBase *renderer)
+{
+    if(renderer && !renderer->getShaderFiles().empty())
+    {
+        updateDependencies(renderer);
+    }
+}
+
+void ShaderHotReload::update()
+{
+    std::vector<std::pair<VulkanRendererBase*, VkPipeline>> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ready.swap(m_readyPipelines);
+    }
+    for(const auto& [renderer, pipeline] : ready)
+    {
+        renderer->replacePipeline(pipeline);
+    }
+}
+
+void ShaderHotReload::updateDependencies(VulkanRendererBase *renderer)
+{
+    std::vector<std::string> files;
+    for(const std::string& shaderFile : renderer->getShaderFiles())
+    {
+        std::vector<std::string> dependencies;
+        readShaderFile(shaderFile.c_str(), &dependencies);
+        // a shader that fails to load is still watched, so fixing it triggers a rebuild
+        if(dependencies.empty()) { dependencies.push_back(fs::path(shaderFile).lexically_normal().generic_string()); }
+        files.insert(files.end(), dependencies.begin(), dependencies.end());
+    }
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+#if defined(__linux__)
+    for(const std::string& file : files)
+    {
+        std::string dir = fs::path(file).parent_path().generic_string();
+        if(dir.empty()) { dir = "."; }
+
+        // inotify hands out the same descriptor for a directory that is already watched
+        const int wd = (m_inotify >= 0) ? inotify_add_watch(m_inotify, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) : -1;
+        if(wd >= 0) { m_watchedDirs[wd] = dir; }
+    }
+#else
+    std::error_code ec;
+    for(const std::string& file : files)
+    {
+        if(!m_modificationTimes.contains(file))
+        {
+            m_modificationTimes[file] = fs::last_write_time(file, ec).time_since_epoch().count();
+        }
+    }
+#endif
+
+    m_dependencies[renderer] = std::move(files);
+}
+
+#if defined(__linux__)
+
+bool ShaderHotReload::waitForChanges(std::vector<std::string> &changedFiles)
+{
+    bool bSettling = false;
+    while(!bStopping)
+    {
+        pollfd pfd = { .fd = m_inotify, .events = POLLIN, .revents = 0 };
+        const int ready = poll(&pfd, 1, bSettling ? kSettleMilliseconds : 100);
+        if(ready <= 0)
+        {
+            if(bSettling) { break; }
+            continue;
+        }
+
+        alignas(inotify_event) char buffer[4096];
+        ssize_t size;
+        while((size = read(m_inotify, buffer, sizeof(buffer))) > 0)
+        {
+            for(const char* p = buffer; p < buffer + size; )
+            {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                p += sizeof(inotify_event) + event->len;
+                if(!event->len) { continue; }
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                const auto it = m_watchedDirs.find(event->wd);
+                if(it != m_watchedDirs.end())
+                {
+                    changedFiles.push_back((fs::path(it->second) / event->name).lexically_normal().generic_string());
+                }
+            }
+        }
+        bSettling = true;
+    }
+
+    std::sort(changedFiles.begin(), changedFiles.end());
+    changedFiles.erase(std::unique(changedFiles.begin(), changedFiles.end()), changedFiles.end());
+    return !changedFiles.empty();
+}
+
+#else
+
+bool ShaderHotReload::waitForChanges(std::vector<std::string> &changedFiles)
+{
+    while(!bStopping)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::error_code ec;
+        for(auto& [file, time] : m_modificationTimes)
+        {
+            const long long current = fs::last_write_time(file, ec).time_since_epoch().count();
+            if(!ec && current != time)
+            {
+                time = current;
+                changedFiles.push_back(file);
+            }
+        }
+        if(!changedFiles.empty())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
+
+void ShaderHotReload::rebuild(const std::vector<std::string> &changedFiles)
+{
+    std::vector<VulkanRendererBase*> affected;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(const auto& [renderer, files] : m_dependencies)
+        {
+            const bool bAffected = std::any_of(changedFiles.begin(), changedFiles.end(), [&](const std::string& changed)
+            {
+                return std::binary_search(files.begin(), files.end(), changed);
+            });
+            if(bAffected) { affected.push_back(renderer); }
+        }
+    }
+    if(affected.empty()) { return; }
+
+    for(const std::string& file : changedFiles)
+    {
+        invalidateShaderSource(file.c_str());
+    }
+
+    for(VulkanRendererBase* renderer : affected)
+    {
+        // the edit may have added or removed #includes
+        updateDependencies(renderer);
+
+        // stages whose expanded source did not change come straight from the SPIR-V cache
+        const auto start = std::chrono::steady_clock::now();
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        if(!renderer->rebuildPipeline(m_vkDev, &pipeline))
+        {
+            printf("ShaderHotReload: '%s' failed to build, keeping the current pipeline\n", renderer->getShaderFiles()[0].c_str());
+            continue;
+        }
+        printf("ShaderHotReload: rebuilt '%s' in %.1f ms\n", renderer->getShaderFiles()[0].c_str(),
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // an older rebuild that update() has not picked up yet is superseded
+        const auto it = std::find_if(m_readyPipelines.begin(), m_readyPipelines.end(), [&](const auto& ready) { return ready.first == renderer; });
+        if(it != m_readyPipelines.end())
+        {
+            vkDestroyPipeline(m_vkDev.device, it->second, nullptr);
+            it->second = pipeline;
+        }
+        else
+        {
+            m_readyPipelines.emplace_back(renderer, pipeline);
+        }
+    }
+}
+
+void ShaderHotReload::watcherLoop()
+{
+    std::vector<std::string> changedFiles;
+    while(!bStopping)
+    {
+        changedFiles.clear();
+        if(waitForChanges(changedFiles))
+        {
+            rebuild(changedFiles);
+        }
+    }
+}
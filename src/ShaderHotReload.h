@@ -0,0 +1,65 @@
+#pragma once
+
+#include "VulkanRendererBase.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Watches the shader files of renderers, including everything they #include, and rebuilds the graphics pipeline
+ * of a renderer on a background thread when one of its files is saved. Watching uses inotify on Linux and polls
+ * modification times elsewhere.
+ * A renderer keeps drawing with its old pipeline until update() swaps in the new one; a shader that does not compile
+ * leaves the old pipeline in place.
+ */
+class ShaderHotReload
+{
+public:
+
+    explicit ShaderHotReload(VulkanRenderDevice& vkDev);
+    /* Has to run before the renderers are destroyed */
+    ~ShaderHotReload();
+
+    ShaderHotReload(const ShaderHotReload&) = delete;
+    ShaderHotReload& operator=(const ShaderHotReload&) = delete;
+
+    /* Renderers whose pipeline was not made by createPipeline() are ignored */
+    void addRenderer(VulkanRendererBase* renderer);
+
+    /* Swaps in the pipelines rebuilt since the last call; call between frames, when no command buffer is in flight */
+    void update();
+
+private:
+
+    void watcherLoop();
+
+    /* Blocks until watched files change or the watcher stops; names are normalized like readShaderFile() dependencies */
+    bool waitForChanges(std::vector<std::string>& changedFiles);
+
+    /* Re-reads the include graph of a renderer and watches any new directory */
+    void updateDependencies(VulkanRendererBase* renderer);
+
+    void rebuild(const std::vector<std::string>& changedFiles);
+
+    VulkanRenderDevice& m_vkDev;
+
+    std::mutex m_mutex;
+    // every file each renderer's shaders were assembled from
+    std::unordered_map<VulkanRendererBase*, std::vector<std::string>> m_dependencies;
+    // pipelines built by the watcher thread, waiting for update()
+    std::vector<std::pair<VulkanRendererBase*, VkPipeline>> m_readyPipelines;
+
+#if defined(__linux__)
+    int m_inotify = -1;
+    std::unordered_map<int, std::string> m_watchedDirs;
+#else
+    std::unordered_map<std::string, long long> m_modificationTimes;
+#endif
+
+    std::atomic<bool> bStopping = false;
+    std::thread m_watcher;
+};
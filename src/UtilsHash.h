@@ -0,0 +1,221 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * 64-bit non-cryptographic hash (XXH64 algorithm).
+ * Used for mesh file checksums and content keys; the 4-lane main loop keeps it memory bound.
+ */
+namespace Hash
+{
+    static constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+    static constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr uint64_t kPrime3 = 0x165667B19E3779F9ull;
+    static constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+    static constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+    inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    inline uint64_t read64(const uint8_t* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+    inline uint32_t read32(const uint8_t* p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+
+    inline uint64_t round(uint64_t acc, uint64_t input)
+    {
+        acc += input * kPrime2;
+        acc = rotl(acc, 31);
+        return acc * kPrime1;
+    }
+
+    inline uint64_t mergeRound(uint64_t acc, uint64_t val)
+    {
+        acc ^= round(0, val);
+        return acc * kPrime1 + kPrime4;
+    }
+}
+
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0)
+{
+    using namespace Hash;
+
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* const end = p + size;
+    uint64_t h;
+
+    if(size >= 32)
+    {
+        uint64_t v1 = seed + kPrime1 + kPrime2;
+        uint64_t v2 = seed + kPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kPrime1;
+
+        const uint8_t* const limit = end - 32;
+        do
+        {
+            v1 = round(v1, read64(p)); p += 8;
+            v2 = round(v2, read64(p)); p += 8;
+            v3 = round(v3, read64(p)); p += 8;
+            v4 = round(v4, read64(p)); p += 8;
+        } while(p <= limit);
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    }
+    else
+    {
+        h = seed + kPrime5;
+    }
+
+    h += static_cast<uint64_t>(size);
+
+    while(p + 8 <= end)
+    {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * kPrime1 + kPrime4;
+        p += 8;
+    }
+    if(p + 4 <= end)
+    {
+        h ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+        h = rotl(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    while(p < end)
+    {
+        h ^= (*p) * kPrime5;
+        h = rotl(h, 11) * kPrime1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+/**
+ * Incremental version of hashBytes(): feeding the same bytes in any number of update() calls
+ * gives the same digest, so data can be hashed while it is streamed to disk.
+ */
+class HashStream
+{
+public:
+
+    explicit HashStream(uint64_t seed = 0) :
+        m_seed(seed),
+        m_v{ seed + Hash::kPrime1 + Hash::kPrime2, seed + Hash::kPrime2, seed, seed - Hash::kPrime1 }
+    {
+    }
+
+    void update(const void* data, size_t size)
+    {
+        using namespace Hash;
+
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        const uint8_t* const end = p + size;
+        m_totalSize += size;
+
+        if(m_bufferSize + size < 32)
+        {
+            memcpy(m_buffer + m_bufferSize, p, size);
+            m_bufferSize += size;
+            return;
+        }
+
+        if(m_bufferSize)
+        {
+            const size_t fill = 32 - m_bufferSize;
+            memcpy(m_buffer + m_bufferSize, p, fill);
+            p += fill;
+            consumeStripe(m_buffer);
+            m_bufferSize = 0;
+        }
+
+        while(p + 32 <= end)
+        {
+            consumeStripe(p);
+            p += 32;
+        }
+
+        m_bufferSize = static_cast<size_t>(end - p);
+        memcpy(m_buffer, p, m_bufferSize);
+    }
+
+    uint64_t digest() const
+    {
+        using namespace Hash;
+
+        uint64_t h;
+        if(m_totalSize >= 32)
+        {
+            h = rotl(m_v[0], 1) + rotl(m_v[1], 7) + rotl(m_v[2], 12) + rotl(m_v[3], 18);
+            h = mergeRound(h, m_v[0]);
+            h = mergeRound(h, m_v[1]);
+            h = mergeRound(h, m_v[2]);
+            h = mergeRound(h, m_v[3]);
+        }
+        else
+        {
+            h = m_seed + kPrime5;
+        }
+
+        h += m_totalSize;
+
+        const uint8_t* p = m_buffer;
+        const uint8_t* const end = m_buffer + m_bufferSize;
+        while(p + 8 <= end)
+        {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * kPrime1 + kPrime4;
+            p += 8;
+        }
+        if(p + 4 <= end)
+        {
+            h ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+            h = rotl(h, 23) * kPrime2 + kPrime3;
+            p += 4;
+        }
+        while(p < end)
+        {
+            h ^= (*p) * kPrime5;
+            h = rotl(h, 11) * kPrime1;
+            p++;
+        }
+
+        h ^= h >> 33;
+        h *= kPrime2;
+        h ^= h >> 29;
+        h *= kPrime3;
+        h ^= h >> 32;
+
+        return h;
+    }
+
+private:
+
+    void consumeStripe(const uint8_t* p)
+    {
+        m_v[0] = Hash::round(m_v[0], Hash::read64(p));
+        m_v[1] = Hash::round(m_v[1], Hash::read64(p + 8));
+        m_v[2] = Hash::round(m_v[2], Hash::read64(p + 16));
+        m_v[3] = Hash::round(m_v[3], Hash::read64(p + 24));
+    }
+
+    uint64_t m_seed;
+    uint64_t m_v[4];
+    uint64_t m_totalSize = 0;
+    uint8_t m_buffer[32];
+    size_t m_bufferSize = 0;
+};
+
+/* Combines a value into a running hash; order dependent */
+inline uint64_t hashCombine(uint64_t seed, uint64_t value)
+{
+    return seed ^ (value + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2));
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+/* Maps a whole file read-only; nullptr if it cannot be opened or is empty */
+inline void* mapFileReadOnly(const char* fileName, size_t* outSize)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE) { return nullptr; }
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if(!mapping) { return nullptr; }
+
+    void* ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    // the view keeps the mapping object alive
+    CloseHandle(mapping);
+
+    *outSize = static_cast<size_t>(size.QuadPart);
+    return ptr;
+#else
+    const int fd = open(fileName, O_RDONLY);
+    if(fd < 0) { return nullptr; }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void* ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+    if(ptr == MAP_FAILED) { return nullptr; }
+
+    madvise(ptr, static_cast<size_t>(st.st_size), MADV_WILLNEED);
+
+    *outSize = static_cast<size_t>(st.st_size);
+    return ptr;
+#endif
+}
+
+/* Releases a mapping from mapFileReadOnly() */
+inline void unmapFile(void* ptr, size_t size)
+{
+#if defined(_WIN32)
+    UnmapViewOfFile(ptr);
+#else
+    munmap(ptr, size);
+#endif
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Fixed set of worker threads consuming a FIFO task queue.
+ * parallelFor() may be called from inside a task: the calling thread works through the loop itself,
+ * so nested loops never wait on tasks that are still queued behind them.
+ */
+class ThreadPool
+{
+public:
+
+    explicit ThreadPool(uint32_t numThreads = std::thread::hardware_concurrency())
+    {
+        numThreads = numThreads ? numThreads : 1;
+        m_workers.reserve(numThreads);
+        for(uint32_t i = 0; i != numThreads; i++)
+        {
+            m_workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            bStopping = true;
+        }
+        m_wakeUp.notify_all();
+        for(std::thread& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    inline uint32_t getNumThreads() const { return static_cast<uint32_t>(m_workers.size()); }
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+        m_wakeUp.notify_one();
+    }
+
+    /* Calls fn(i) for every i in [0, count) and returns once all calls have finished */
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn)
+    {
+        if(count == 0) { return; }
+        if(count == 1) { fn(0); return; }
+
+        struct Loop
+        {
+            std::function<void(size_t)> fn;
+            size_t count = 0;
+            std::atomic<size_t> next = 0;
+            std::atomic<size_t> done = 0;
+            std::mutex mutex;
+            std::condition_variable finished;
+
+            // claims iterations until none are left; safe to run after the loop has completed
+            void run()
+            {
+                size_t i;
+                while((i = next.fetch_add(1)) < count)
+                {
+                    fn(i);
+                    if(done.fetch_add(1) + 1 == count)
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        finished.notify_all();
+                    }
+                }
+            }
+        };
+
+        auto loop = std::make_shared<Loop>();
+        loop->fn = fn;
+        loop->count = count;
+
+        const size_t numHelpers = std::min<size_t>(count - 1, m_workers.size());
+        for(size_t i = 0; i != numHelpers; i++)
+        {
+            submit([loop]() { loop->run(); });
+        }
+
+        loop->run();
+
+        // only iterations claimed by running helpers are left at this point
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->finished.wait(lock, [&]() { return loop->done.load() == count; });
+    }
+
+private:
+
+    void workerLoop()
+    {
+        for(;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wakeUp.wait(lock, [this]() { return bStopping || !m_tasks.empty(); });
+                if(m_tasks.empty()) { return; }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeUp;
+    bool bStopping = false;
+};
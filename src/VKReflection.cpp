@@ -0,0 +1,546 @@
+#include "VKReflection.h"
+#include "VKShader.h"
+#include "UtilsHash.h"
+#if BUILD_WITH_EMBEDDED_SHADERS
+#include "EmbeddedShaders.h"
+#endif
+
+#include <stdio.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+constexpr const unsigned int kSPIRVMagic = 0x07230203;
+
+// the few SPIR-V opcodes, decorations and storage classes that describe resources
+enum
+{
+    eOpTypeInt = 21,
+    eOpTypeFloat = 22,
+    eOpTypeVector = 23,
+    eOpTypeMatrix = 24,
+    eOpTypeImage = 25,
+    eOpTypeSampler = 26,
+    eOpTypeSampledImage = 27,
+    eOpTypeArray = 28,
+    eOpTypeRuntimeArray = 29,
+    eOpTypeStruct = 30,
+    eOpTypePointer = 32,
+    eOpConstant = 43,
+    eOpSpecConstant = 50,
+    eOpVariable = 59,
+    eOpDecorate = 71,
+    eOpMemberDecorate = 72,
+    eOpTypeAccelerationStructure = 5341
+};
+
+enum
+{
+    eDecorationBufferBlock = 3,
+    eDecorationRowMajor = 4,
+    eDecorationArrayStride = 6,
+    eDecorationMatrixStride = 7,
+    eDecorationBinding = 33,
+    eDecorationDescriptorSet = 34,
+    eDecorationOffset = 35
+};
+
+enum
+{
+    eStorageUniformConstant = 0,
+    eStorageUniform = 2,
+    eStoragePushConstant = 9,
+    eStorageStorageBuffer = 12
+};
+
+enum
+{
+    eDimBuffer = 5,
+    eDimSubpassData = 6
+};
+
+namespace
+{
+    struct SpirvMember
+    {
+        uint32_t offset = 0;
+        uint32_t matrixStride = 0;
+        bool bRowMajor = false;
+    };
+
+    struct SpirvId
+    {
+        uint32_t opcode = 0;
+        // operands after the result id; for OpVariable and OpConstant the ones after the result type
+        std::vector<uint32_t> operands;
+
+        uint32_t set = ~0u;
+        uint32_t binding = ~0u;
+        uint32_t arrayStride = 0;
+        bool bBufferBlock = false;
+        std::vector<SpirvMember> members;
+    };
+
+    class SpirvModule
+    {
+    public:
+
+        bool parse(const unsigned int* code, size_t wordCount);
+
+        const SpirvId* id(uint32_t i) const { return i < m_ids.size() ? &m_ids[i] : nullptr; }
+        const std::vector<uint32_t>& variables() const { return m_variables; }
+
+        /* Number of descriptors behind a (possibly arrayed) type, 0 for runtime arrays; strips the arrays from 'type' */
+        uint32_t arraySize(uint32_t& type) const;
+        /* Bytes a member of type 'type' occupies in a block */
+        uint32_t typeSize(uint32_t type, const SpirvMember& layout) const;
+
+    private:
+
+        SpirvMember& member(uint32_t structId, uint32_t index)
+        {
+            SpirvId& s = m_ids[structId];
+            if(s.members.size() <= index) { s.members.resize(index + 1); }
+            return s.members[index];
+        }
+
+        std::vector<SpirvId> m_ids;
+        std::vector<uint32_t> m_variables;
+    };
+}
+
+bool SpirvModule::parse(const unsigned int* code, size_t wordCount)
+{
+    // every id is the result of an instruction, a larger bound is garbage
+    if(wordCount < 5 || code[0] != kSPIRVMagic || code[3] > wordCount) { return false; }
+    m_ids.assign(code[3], SpirvId());
+
+    for(size_t i = 5; i < wordCount; )
+    {
+        const uint32_t opcode = code[i] & 0xFFFF;
+        const uint32_t count = code[i] >> 16;
+        if(count == 0 || i + count > wordCount) { return false; }
+        const unsigned int* op = code + i + 1;
+        const uint32_t operandCount = count - 1;
+        i += count;
+
+        switch(opcode)
+        {
+        case eOpTypeInt: case eOpTypeFloat: case eOpTypeVector: case eOpTypeMatrix:
+        case eOpTypeImage: case eOpTypeSampler: case eOpTypeSampledImage:
+        case eOpTypeArray: case eOpTypeRuntimeArray: case eOpTypeStruct: case eOpTypePointer:
+        case eOpTypeAccelerationStructure:
+            if(operandCount < 1 || op[0] >= m_ids.size()) { return false; }
+            m_ids[op[0]].opcode = opcode;
+            m_ids[op[0]].operands.assign(op + 1, op + operandCount);
+            break;
+
+        case eOpConstant: case eOpSpecConstant: case eOpVariable:
+            if(operandCount < 2 || op[1] >= m_ids.size()) { return false; }
+            m_ids[op[1]].opcode = opcode;
+            m_ids[op[1]].operands.assign(op, op + 1);
+            m_ids[op[1]].operands.insert(m_ids[op[1]].operands.end(), op + 2, op + operandCount);
+            if(opcode == eOpVariable) { m_variables.push_back(op[1]); }
+            break;
+
+        case eOpDecorate:
+        {
+            if(operandCount < 2 || op[0] >= m_ids.size()) { return false; }
+            SpirvId& target = m_ids[op[0]];
+            const uint32_t value = (operandCount > 2) ? op[2] : 0;
+            if(op[1] == eDecorationDescriptorSet) { target.set = value; }
+            else if(op[1] == eDecorationBinding) { target.binding = value; }
+            else if(op[1] == eDecorationArrayStride) { target.arrayStride = value; }
+            else if(op[1] == eDecorationBufferBlock) { target.bBufferBlock = true; }
+            break;
+        }
+
+        case eOpMemberDecorate:
+        {
+            if(operandCount < 3 || op[0] >= m_ids.size()) { return false; }
+            const uint32_t value = (operandCount > 3) ? op[3] : 0;
+            if(op[2] == eDecorationOffset) { member(op[0], op[1]).offset = value; }
+            else if(op[2] == eDecorationMatrixStride) { member(op[0], op[1]).matrixStride = value; }
+            else if(op[2] == eDecorationRowMajor) { member(op[0], op[1]).bRowMajor = true; }
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+uint32_t SpirvModule::arraySize(uint32_t& type) const
+{
+    uint32_t size = 1;
+    for(const SpirvId* t = id(type); t && (t->opcode == eOpTypeArray || t->opcode == eOpTypeRuntimeArray); t = id(type))
+    {
+        if(t->opcode == eOpTypeRuntimeArray)
+        {
+            size = 0;
+        }
+        else
+        {
+            // the length is a constant or a specialization constant, whose default is used
+            const SpirvId* length = (t->operands.size() > 1) ? id(t->operands[1]) : nullptr;
+            size *= (length && length->operands.size() > 1) ? length->operands[1] : 1;
+        }
+        type = t->operands.empty() ? 0 : t->operands[0];
+    }
+    return size;
+}
+
+uint32_t SpirvModule::typeSize(uint32_t type, const SpirvMember& layout) const
+{
+    const SpirvId* t = id(type);
+    if(!t || t->operands.empty()) { return 0; }
+
+    switch(t->opcode)
+    {
+    case eOpTypeInt:
+    case eOpTypeFloat:
+        return t->operands[0] / 8;
+    case eOpTypeVector:
+        return (t->operands.size() > 1) ? typeSize(t->operands[0], layout) * t->operands[1] : 0;
+    case eOpTypeMatrix:
+    {
+        if(t->operands.size() < 2) { return 0; }
+        // row-major matrices are stored as rows, as many as a column has components
+        const SpirvId* column = id(t->operands[0]);
+        const uint32_t vectors = layout.bRowMajor ? ((column && column->operands.size() > 1) ? column->operands[1] : 0) : t->operands[1];
+        return vectors * layout.matrixStride;
+    }
+    case eOpTypeArray:
+    {
+        // the stride of the outer array already covers any inner one
+        const SpirvId* length = (t->operands.size() > 1) ? id(t->operands[1]) : nullptr;
+        return ((length && length->operands.size() > 1) ? length->operands[1] : 0) * t->arrayStride;
+    }
+    case eOpTypeStruct:
+    {
+        uint32_t size = 0;
+        for(size_t i = 0; i < t->operands.size() && i < t->members.size(); i++)
+        {
+            size = std::max(size, t->members[i].offset + typeSize(t->operands[i], t->members[i]));
+        }
+        return size;
+    }
+    default:
+        // runtime arrays and opaque types take no space of their own
+        return 0;
+    }
+}
+
+static bool descriptorType(uint32_t storageClass, const SpirvId* type, VkDescriptorType* descriptorType)
+{
+    if(!type) { return false; }
+
+    if(storageClass == eStorageStorageBuffer || (storageClass == eStorageUniform && type->bBufferBlock))
+    {
+        *descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        return true;
+    }
+    if(storageClass == eStorageUniform)
+    {
+        *descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        return true;
+    }
+    if(storageClass != eStorageUniformConstant) { return false; }
+
+    switch(type->opcode)
+    {
+    case eOpTypeSampler:
+        *descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+        return true;
+    case eOpTypeSampledImage:
+        *descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        return true;
+    case eOpTypeAccelerationStructure:
+        *descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+        return true;
+    case eOpTypeImage:
+    {
+        // operands: sampled type, dim, depth, arrayed, multisampled, sampled (1 = with a sampler, 2 = storage)
+        if(type->operands.size() < 6) { return false; }
+        const uint32_t dim = type->operands[1];
+        const bool bStorage = (type->operands[5] == 2);
+        if(dim == eDimSubpassData) { *descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT; }
+        else if(dim == eDimBuffer) { *descriptorType = bStorage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER; }
+        else { *descriptorType = bStorage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE; }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+bool addDescriptorBinding(ShaderReflection &reflection, uint32_t set, const VkDescriptorSetLayoutBinding &binding)
+{
+    if(reflection.descriptorSets.size() <= set) { reflection.descriptorSets.resize(set + 1); }
+    std::vector<VkDescriptorSetLayoutBinding>& bindings = reflection.descriptorSets[set];
+
+    const auto it = std::lower_bound(bindings.begin(), bindings.end(), binding.binding,
+        [](const VkDescriptorSetLayoutBinding& b, uint32_t index) { return b.binding < index; });
+    if(it == bindings.end() || it->binding != binding.binding)
+    {
+        bindings.insert(it, binding);
+        return true;
+    }
+    if(it->descriptorType != binding.descriptorType || it->descriptorCount != binding.descriptorCount)
+    {
+        printf("Reflection: set %u binding %u is declared differently in two stages\n", set, binding.binding);
+        return false;
+    }
+    it->stageFlags |= binding.stageFlags;
+    return true;
+}
+
+/* A stage has one push constant block; stages reading the same bytes share a range */
+static void addPushConstantRange(ShaderReflection& reflection, const VkPushConstantRange& range)
+{
+    auto it = std::find_if(reflection.pushConstantRanges.begin(), reflection.pushConstantRanges.end(), [&](const VkPushConstantRange& r)
+    {
+        return r.offset == range.offset && r.size == range.size;
+    });
+    if(it != reflection.pushConstantRanges.end()) { it->stageFlags |= range.stageFlags; }
+    else { reflection.pushConstantRanges.push_back(range); }
+}
+
+bool reflectSPIRV(const unsigned int *code, size_t wordCount, VkShaderStageFlagBits stage, ShaderReflection &reflection)
+{
+    SpirvModule module;
+    if(!module.parse(code, wordCount))
+    {
+        printf("Reflection: malformed SPIR-V\n");
+        return false;
+    }
+
+    for(uint32_t v : module.variables())
+    {
+        const SpirvId* variable = module.id(v);
+        const SpirvId* pointer = module.id(variable->operands[0]);
+        if(!pointer || pointer->opcode != eOpTypePointer || pointer->operands.size() < 2) { continue; }
+
+        const uint32_t storageClass = variable->operands[1];
+        uint32_t type = pointer->operands[1];
+
+        if(storageClass == eStoragePushConstant)
+        {
+            const SpirvId* block = module.id(type);
+            if(!block || block->opcode != eOpTypeStruct) { continue; }
+
+            uint32_t begin = ~0u;
+            for(size_t i = 0; i < block->operands.size() && i < block->members.size(); i++)
+            {
+                begin = std::min(begin, block->members[i].offset);
+            }
+            const uint32_t end = module.typeSize(type, SpirvMember());
+            if(begin >= end) { continue; }
+
+            addPushConstantRange(reflection, { static_cast<VkShaderStageFlags>(stage), begin & ~3u, ((end + 3) & ~3u) - (begin & ~3u) });
+            continue;
+        }
+
+        if(storageClass != eStorageUniformConstant && storageClass != eStorageUniform && storageClass != eStorageStorageBuffer) { continue; }
+
+        const uint32_t count = module.arraySize(type);
+        VkDescriptorType dType;
+        if(!descriptorType(storageClass, module.id(type), &dType)) { continue; }
+
+        if(variable->set == ~0u || variable->binding == ~0u)
+        {
+            printf("Reflection: a resource has no binding\n");
+            return false;
+        }
+        if(count == 0)
+        {
+            printf("Reflection: set %u binding %u is an unsized array, which needs descriptor indexing\n", variable->set, variable->binding);
+            return false;
+        }
+        if(!addDescriptorBinding(reflection, variable->set, descriptorSetLayoutBinding(variable->binding, dType, stage, count)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool reflectShaderFiles(const std::vector<const char*> &shaderFiles, ShaderReflection &reflection)
+{
+    return reflectShaderFiles(std::vector<ShaderVariant>(shaderFiles.begin(), shaderFiles.end()), reflection);
+}
+
+bool reflectShaderFiles(const std::vector<ShaderVariant> &shaders, ShaderReflection &reflection)
+{
+    for(const ShaderVariant& variant : shaders)
+    {
+        const char* file = variant.file.c_str();
+#if BUILD_WITH_EMBEDDED_SHADERS
+        // reflected when the shader was compiled into the application
+        if(const EmbeddedShader* shader = findEmbeddedShader(file, variant.defines))
+        {
+            for(size_t i = 0; i != shader->bindingCount; i++)
+            {
+                const EmbeddedBinding& b = shader->bindings[i];
+                if(!addDescriptorBinding(reflection, b.set, descriptorSetLayoutBinding(b.binding, b.type, shader->stage, b.count))) { return false; }
+            }
+            if(shader->pushConstants.size) { addPushConstantRange(reflection, shader->pushConstants); }
+            continue;
+        }
+#endif
+        ShaderModule module;
+        if(!compileShaderFile(file, module, variant.defines) ||
+           !reflectSPIRV(module.SPIRV.data(), module.SPIRV.size(), getVkShaderStageFromFileName(file), reflection))
+        {
+            printf("Reflection: cannot reflect '%s'\n", file);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isLayoutCompatible(const ShaderReflection &shaders, const ShaderReflection &layout)
+{
+    for(size_t set = 0; set < shaders.descriptorSets.size(); set++)
+    {
+        for(const VkDescriptorSetLayoutBinding& b : shaders.descriptorSets[set])
+        {
+            if(set >= layout.descriptorSets.size()) { return false; }
+            const std::vector<VkDescriptorSetLayoutBinding>& bindings = layout.descriptorSets[set];
+            const auto it = std::find_if(bindings.begin(), bindings.end(), [&](const VkDescriptorSetLayoutBinding& l) { return l.binding == b.binding; });
+            if(it == bindings.end() || it->descriptorType != b.descriptorType || it->descriptorCount != b.descriptorCount ||
+               (it->stageFlags & b.stageFlags) != b.stageFlags)
+            {
+                return false;
+            }
+        }
+    }
+    for(const VkPushConstantRange& r : shaders.pushConstantRanges)
+    {
+        const bool bFound = std::any_of(layout.pushConstantRanges.begin(), layout.pushConstantRanges.end(), [&](const VkPushConstantRange& l)
+        {
+            return (l.stageFlags & r.stageFlags) == r.stageFlags && l.offset <= r.offset && r.offset + r.size <= l.offset + l.size;
+        });
+        if(!bFound) { return false; }
+    }
+    return true;
+}
+
+namespace
+{
+    struct SharedSetLayout
+    {
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    };
+}
+
+// by hash of the bindings; several entries per hash only on a collision
+static std::unordered_multimap<uint64_t, SharedSetLayout> g_setLayouts;
+static std::mutex g_setLayoutMutex;
+
+static bool sameBindings(const std::vector<VkDescriptorSetLayoutBinding>& a, const std::vector<VkDescriptorSetLayoutBinding>& b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const VkDescriptorSetLayoutBinding& x, const VkDescriptorSetLayoutBinding& y)
+    {
+        return x.binding == y.binding && x.descriptorType == y.descriptorType &&
+               x.descriptorCount == y.descriptorCount && x.stageFlags == y.stageFlags;
+    });
+}
+
+VkDescriptorSetLayout getDescriptorSetLayout(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding> &bindings)
+{
+    uint64_t key = hashCombine(0, bindings.size());
+    for(const VkDescriptorSetLayoutBinding& b : bindings)
+    {
+        key = hashCombine(key, b.binding);
+        key = hashCombine(key, b.descriptorType);
+        key = hashCombine(key, b.descriptorCount);
+        key = hashCombine(key, b.stageFlags);
+    }
+
+    std::lock_guard<std::mutex> lock(g_setLayoutMutex);
+
+    const auto range = g_setLayouts.equal_range(key);
+    for(auto it = range.first; it != range.second; ++it)
+    {
+        if(sameBindings(it->second.bindings, bindings)) { return it->second.layout; }
+    }
+
+    const VkDescriptorSetLayoutCreateInfo layoutInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .bindingCount = static_cast<uint32_t>(bindings.size()),
+        .pBindings = bindings.empty() ? nullptr : bindings.data()
+    };
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    if(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) { return VK_NULL_HANDLE; }
+
+    g_setLayouts.emplace(key, SharedSetLayout{ bindings, layout });
+    return layout;
+}
+
+void destroyDescriptorSetLayouts(VkDevice device)
+{
+    std::lock_guard<std::mutex> lock(g_setLayoutMutex);
+    for(const auto& [key, shared] : g_setLayouts)
+    {
+        vkDestroyDescriptorSetLayout(device, shared.layout, nullptr);
+    }
+    g_setLayouts.clear();
+}
+
+bool createDescriptorPool(VulkanRenderDevice &vkDev, const ShaderReflection &reflection, VkDescriptorPool *descriptorPool)
+{
+    const uint32_t imageCount = static_cast<uint32_t>(vkDev.swapchainImages.size());
+
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for(const std::vector<VkDescriptorSetLayoutBinding>& bindings : reflection.descriptorSets)
+    {
+        for(const VkDescriptorSetLayoutBinding& b : bindings)
+        {
+            auto it = std::find_if(poolSizes.begin(), poolSizes.end(), [&](const VkDescriptorPoolSize& s) { return s.type == b.descriptorType; });
+            if(it == poolSizes.end()) { it = poolSizes.insert(poolSizes.end(), VkDescriptorPoolSize{ .type = b.descriptorType, .descriptorCount = 0 }); }
+            it->descriptorCount += imageCount * b.descriptorCount;
+        }
+    }
+
+    const VkDescriptorPoolCreateInfo poolInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .maxSets = imageCount * static_cast<uint32_t>(std::max<size_t>(reflection.descriptorSets.size(), 1)),
+        .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+        .pPoolSizes = poolSizes.empty() ? nullptr : poolSizes.data()
+    };
+
+    return (vkCreateDescriptorPool(vkDev.device, &poolInfo, nullptr, descriptorPool) == VK_SUCCESS);
+}
+
+bool createPipelineLayout(VkDevice device, const ShaderReflection &reflection, VkPipelineLayout *pipelineLayout)
+{
+    std::vector<VkDescriptorSetLayout> setLayouts;
+    for(const std::vector<VkDescriptorSetLayoutBinding>& bindings : reflection.descriptorSets)
+    {
+        setLayouts.push_back(getDescriptorSetLayout(device, bindings));
+        if(setLayouts.back() == VK_NULL_HANDLE) { return false; }
+    }
+
+    const VkPipelineLayoutCreateInfo pipelineLayoutInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+        .pSetLayouts = setLayouts.empty() ? nullptr : setLayouts.data(),
+        .pushConstantRangeCount = static_cast<uint32_t>(reflection.pushConstantRanges.size()),
+        .pPushConstantRanges = reflection.pushConstantRanges.empty() ? nullptr : reflection.pushConstantRanges.data()
+    };
+
+    return (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, pipelineLayout) == VK_SUCCESS);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include "VKUtils.h"
+
+#include <vector>
+
+/* Descriptor bindings and push constants used by the shader stages of a pipeline, read from their SPIR-V */
+struct ShaderReflection
+{
+    // indexed by set number, bindings sorted by binding number
+    std::vector<std::vector<VkDescriptorSetLayoutBinding>> descriptorSets;
+    // at most one range per stage
+    std::vector<VkPushConstantRange> pushConstantRanges;
+};
+
+/**
+ * Adds the resources one stage uses to 'reflection'. A binding used by several stages gets the flags of all of them.
+ * False if the SPIR-V is malformed, a resource has no binding or the same binding has a different type in another stage.
+ */
+bool reflectSPIRV(const unsigned int* code, size_t wordCount, VkShaderStageFlagBits stage, ShaderReflection& reflection);
+
+/**
+ * Compiles every stage of a pipeline, through the shader cache, and reflects them into one ShaderReflection.
+ * Array sizes given by specialization constants are taken at their default values.
+ */
+bool reflectShaderFiles(const std::vector<const char*>& shaderFiles, ShaderReflection& reflection);
+bool reflectShaderFiles(const std::vector<ShaderVariant>& shaders, ShaderReflection& reflection);
+
+/* For resources the layout needs before a shader declares them; same merging rules as reflectSPIRV() */
+bool addDescriptorBinding(ShaderReflection& reflection, uint32_t set, const VkDescriptorSetLayoutBinding& binding);
+
+/* True if a pipeline using 'shaders' can be created with the pipeline layout made from 'layout' */
+bool isLayoutCompatible(const ShaderReflection& shaders, const ShaderReflection& layout);
+
+/**
+ * Set layout for a list of bindings. Layouts are kept by the hash of their bindings: every caller asking for the same
+ * bindings gets the same VkDescriptorSetLayout, so it must not be destroyed by them. VK_NULL_HANDLE on failure.
+ */
+VkDescriptorSetLayout getDescriptorSetLayout(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+/* Destroys the shared set layouts; once every pipeline layout and descriptor pool made from them is gone */
+void destroyDescriptorSetLayouts(VkDevice device);
+
+/* Pool holding one copy of every set of 'reflection' per swapchain image, with exactly the descriptors they need */
+bool createDescriptorPool(VulkanRenderDevice& vkDev, const ShaderReflection& reflection, VkDescriptorPool* descriptorPool);
+
+/* Pipeline layout with the shared set layouts and the push constant ranges of 'reflection' */
+bool createPipelineLayout(VkDevice device, const ShaderReflection& reflection, VkPipelineLayout* pipelineLayout);
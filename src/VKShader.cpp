@@ -1,16 +1,46 @@
 #include "VKShader.h"
+#include "UtilsHash.h"
+#include "UtilsThreadPool.h"
 
+#if BUILD_WITH_EMBEDDED_SHADERS
+#include "EmbeddedShaders.h"
+#else
 #include <glslang/Public/resource_limits_c.h>
 #include <glslang/Include/glslang_c_interface.h>
 
 #include <glslang/Public/ShaderLang.h>
+#endif
+#if BUILD_WITH_SPIRV_OPT
+#include <spirv-tools/optimizer.hpp>
+#endif
 
 #include <assert.h>
 #include <stdio.h>
 #include <string>
 #include <string.h>
-#include <malloc.h>
-
+#include <ctype.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+// Bumped whenever compileShader() starts producing different SPIR-V for the same input (glslang update, options)
+constexpr const uint32_t kShaderCacheVersion = 1;
+
+constexpr const unsigned int kSPIRVMagic = 0x07230203;
+
+static std::string g_shaderCacheDir = "shader_cache";
+static std::atomic<ShaderOptimization> g_shaderOptimization = ShaderOptimization::None;
+// SPIR-V compiled or loaded by this process, by cache key
+static std::unordered_map<uint64_t, std::vector<unsigned int>> g_spirvCache;
+static std::mutex g_shaderCacheMutex;
+// variants queued by compileShaderFilesAsync() that have not finished yet, by shaderVariantName()
+static std::unordered_map<std::string, std::shared_future<size_t>> g_pendingShaders;
 
 
 int endsWith(const char *s, const char *part)
@@ -18,51 +48,234 @@ int endsWith(const char *s, const char *part)
     return (strstr(s, part) - s) == (strlen(s) - strlen(part));
 }
 
-std::string readShaderFile(const char *fileName)
+/* A shader source file as read from disk, shared by every shader that includes it */
+struct ShaderSourceFile
+{
+    std::string text;
+    /* '#pragma once' or an include guard around the whole file: a second #include of it adds nothing */
+    bool bGuarded = false;
+};
+
+// every file is read once, later #includes of it are served from here
+static std::unordered_map<std::string, std::shared_ptr<const ShaderSourceFile>> g_shaderSources;
+static std::mutex g_shaderSourceMutex;
+
+static std::string_view trimLeft(std::string_view line)
+{
+    while(!line.empty() && (line.front() == ' ' || line.front() == '\t')) { line.remove_prefix(1); }
+    return line;
+}
+
+/* The directive name of a preprocessor line ("include", "ifndef", ...), empty for other lines */
+static std::string_view directiveName(std::string_view line, std::string_view* rest = nullptr)
+{
+    line = trimLeft(line);
+    if(line.empty() || line.front() != '#') { return {}; }
+    line = trimLeft(line.substr(1));
+
+    size_t n = 0;
+    while(n < line.size() && isalpha(static_cast<unsigned char>(line[n]))) { n++; }
+    if(rest) { *rest = trimLeft(line.substr(n)); }
+    return line.substr(0, n);
+}
+
+static std::string_view firstWord(std::string_view s)
+{
+    size_t n = 0;
+    while(n < s.size() && (isalnum(static_cast<unsigned char>(s[n])) || s[n] == '_')) { n++; }
+    return s.substr(0, n);
+}
+
+template<typename Fn>
+static void forEachLine(std::string_view text, Fn&& fn)
+{
+    while(!text.empty())
+    {
+        const size_t eol = text.find('\n');
+        std::string_view line = text.substr(0, eol);
+        if(!line.empty() && line.back() == '\r') { line.remove_suffix(1); }
+        fn(line);
+        text = (eol == text.npos) ? std::string_view() : text.substr(eol + 1);
+    }
+}
+
+/* True if the whole file sits inside '#pragma once' or an #ifndef X / #define X ... #endif guard */
+static bool isIncludeGuarded(std::string_view text)
+{
+    enum { eStart, eDefine, eInside, eClosed, eNotGuarded } state = eStart;
+    std::string_view guard;
+    int depth = 0;
+    bool bInComment = false;
+
+    forEachLine(text, [&](std::string_view line)
+    {
+        line = trimLeft(line);
+        if(bInComment)
+        {
+            bInComment = line.find("*/") == line.npos;
+            return;
+        }
+        if(line.starts_with("/*"))
+        {
+            bInComment = line.find("*/", 2) == line.npos;
+            return;
+        }
+        if(state == eNotGuarded || line.empty() || line.starts_with("//")) { return; }
+
+        std::string_view rest;
+        const std::string_view directive = directiveName(line, &rest);
+        switch(state)
+        {
+            case eStart:
+                if(directive == "pragma" && firstWord(rest) == "once") { state = eClosed; depth = -1; return; }
+                state = (directive == "ifndef") ? eDefine : eNotGuarded;
+                guard = firstWord(rest);
+                depth = 1;
+                return;
+            case eDefine:
+                state = (directive == "define" && firstWord(rest) == guard) ? eInside : eNotGuarded;
+                return;
+            case eInside:
+                if(directive == "if" || directive == "ifdef" || directive == "ifndef") { depth++; }
+                else if(directive == "endif" && --depth == 0) { state = eClosed; }
+                return;
+            case eClosed:
+                // '#pragma once' guards whatever follows, an #endif only what it closes
+                if(depth != -1) { state = eNotGuarded; }
+                return;
+            default:
+                return;
+        }
+    });
+    return state == eClosed;
+}
+
+static std::shared_ptr<const ShaderSourceFile> loadShaderSource(const std::string& fileName)
 {
-    FILE* file = fopen(fileName, "r");
+    {
+        std::lock_guard<std::mutex> lock(g_shaderSourceMutex);
+        const auto it = g_shaderSources.find(fileName);
+        if(it != g_shaderSources.end()) { return it->second; }
+    }
+
+    FILE* file = fopen(fileName.c_str(), "rb");
     if(!file)
     {
-        printf("I/O error. Cannot open '%s'\n", fileName);
-        return std::string();
+        printf("I/O error. Cannot open '%s'\n", fileName.c_str());
+        return nullptr;
     }
 
+    auto source = std::make_shared<ShaderSourceFile>();
     fseek(file, 0L, SEEK_END);
-    const auto bytesinfile = ftell(file);
+    source->text.resize(ftell(file));
     fseek(file, 0L, SEEK_SET);
-
-    char* buffer = (char*)alloca(bytesinfile + 1);
-    const size_t bytesread = fread(buffer, 1, bytesinfile, file);
+    source->text.resize(fread(source->text.data(), 1, source->text.size(), file));
     fclose(file);
 
-    buffer[bytesread] = 0;
-    static constexpr unsigned char BOM[] = { 0xEF, 0xBB, 0xBF };
-    if(bytesread > 3)
+    static constexpr char BOM[] = { '\xEF', '\xBB', '\xBF' };
+    if(source->text.size() >= 3 && !memcmp(source->text.data(), BOM, 3))
     {
-        if(!memcmp(buffer, BOM, 3))
-        {
-            memset(buffer, ' ', 3);
-        }
+        source->text.erase(0, 3);
     }
+    source->bGuarded = isIncludeGuarded(source->text);
+
+    std::lock_guard<std::mutex> lock(g_shaderSourceMutex);
+    return g_shaderSources.emplace(fileName, std::move(source)).first->second;
+}
+
+struct IncludeContext
+{
+    std::string code;
+    /* every file pulled in, by source string number */
+    std::vector<std::string> files;
+    /* files currently being expanded, to catch include cycles */
+    std::vector<std::string> stack;
+};
+
+static bool expandShaderSource(const std::string& fileName, uint32_t sourceIndex, IncludeContext& ctx)
+{
+    const std::shared_ptr<const ShaderSourceFile> source = loadShaderSource(fileName);
+    if(!source) { return false; }
 
-    std::string code(buffer);
+    ctx.stack.push_back(fileName);
+    bool bResult = true;
+    uint32_t lineNumber = 0;
 
-    while (code.find("#include ") != code.npos)
+    forEachLine(source->text, [&](std::string_view line)
     {
-        const auto pos = code.find("#include ");
-        const auto p1 = code.find('<', pos);
-        const auto p2 = code.find('>', pos);
-        if(p1 == code.npos || p2 == code.npos || p2 <= p1)
+        lineNumber++;
+        std::string_view rest;
+        if(!bResult) { return; }
+        const std::string_view directive = directiveName(line, &rest);
+        if(directive == "pragma" && firstWord(rest) == "once")
         {
-            printf("Error while loading shader program: %s\n", code.c_str());
-            return std::string();
+            // handled here, glslang would only warn about it
+            ctx.code.push_back('\n');
+            return;
+        }
+        if(directive != "include")
+        {
+            ctx.code.append(line);
+            ctx.code.push_back('\n');
+            return;
+        }
+
+        const char close = rest.starts_with('<') ? '>' : '"';
+        const size_t end = rest.find(close, 1);
+        if(rest.empty() || (rest.front() != '<' && rest.front() != '"') || end == rest.npos)
+        {
+            printf("Error while loading shader program '%s': malformed #include in line %u\n", fileName.c_str(), lineNumber);
+            bResult = false;
+            return;
+        }
+
+        // <> names are relative to the working directory like the shader files themselves, "" names try the including file first
+        std::filesystem::path includePath(rest.substr(1, end - 1));
+        if(close == '"')
+        {
+            const std::filesystem::path local = std::filesystem::path(fileName).parent_path() / includePath;
+            std::error_code ec;
+            if(std::filesystem::exists(local, ec)) { includePath = local; }
+        }
+        // one name per file, however it was spelled
+        const std::string includeName = includePath.lexically_normal().generic_string();
+
+        if(std::find(ctx.stack.begin(), ctx.stack.end(), includeName) != ctx.stack.end())
+        {
+            printf("Error while loading shader program '%s': '%s' includes itself\n", fileName.c_str(), includeName.c_str());
+            bResult = false;
+            return;
+        }
+
+        const auto known = std::find(ctx.files.begin(), ctx.files.end(), includeName);
+        const std::shared_ptr<const ShaderSourceFile> include = loadShaderSource(includeName);
+        if(known != ctx.files.end() && include && include->bGuarded)
+        {
+            // the line stays, empty, so line numbers after it do not move
+            ctx.code.push_back('\n');
+            return;
         }
-        const std::string name = code.substr(p1 + 1, p2 - p1 - 1);
-        const std::string include = readShaderFile(name.c_str());
-        code.replace(pos, p2-pos+1, include.c_str());
-    }
 
-    return code;
+        const uint32_t includeIndex = static_cast<uint32_t>(known != ctx.files.end() ? known - ctx.files.begin() : ctx.files.size());
+        if(known == ctx.files.end()) { ctx.files.push_back(includeName); }
+
+        ctx.code += "#line 1 " + std::to_string(includeIndex) + "\n";
+        bResult = expandShaderSource(includeName, includeIndex, ctx);
+        ctx.code += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(sourceIndex) + "\n";
+    });
+
+    ctx.stack.pop_back();
+    return bResult;
+}
+
+std::string readShaderFile(const char *fileName, std::vector<std::string>* dependencies)
+{
+    IncludeContext ctx;
+    ctx.files.push_back(std::filesystem::path(fileName).lexically_normal().generic_string());
+    if(!expandShaderSource(ctx.files[0], 0, ctx)) { return std::string(); }
+
+    if(dependencies) { *dependencies = std::move(ctx.files); }
+    return std::move(ctx.code);
 }
 
 void printShaderSource(const char *text)
@@ -85,15 +298,146 @@ void printShaderSource(const char *text)
     }
 }
 
-void saveSPIRVBinaryFile(const char *fileName, unsigned int *code, size_t size)
+ShaderSpecialization& ShaderSpecialization::setData(uint32_t constantId, const void *value, size_t size)
+{
+    // setting a constant twice keeps the last value
+    const auto it = std::find_if(m_entries.begin(), m_entries.end(),
+        [constantId](const VkSpecializationMapEntry& entry) { return entry.constantID == constantId; });
+    if(it != m_entries.end())
+    {
+        memcpy(m_data.data() + it->offset, value, size);
+        return *this;
+    }
+
+    m_entries.push_back(VkSpecializationMapEntry{ .constantID = constantId, .offset = static_cast<uint32_t>(m_data.size()), .size = size });
+    m_data.resize(m_data.size() + size);
+    memcpy(m_data.data() + m_entries.back().offset, value, size);
+    return *this;
+}
+
+ShaderSpecialization& ShaderSpecialization::set(uint32_t constantId, uint32_t value)
+{
+    return setData(constantId, &value, sizeof(value));
+}
+
+ShaderSpecialization& ShaderSpecialization::set(uint32_t constantId, int32_t value)
+{
+    return setData(constantId, &value, sizeof(value));
+}
+
+ShaderSpecialization& ShaderSpecialization::set(uint32_t constantId, float value)
+{
+    return setData(constantId, &value, sizeof(value));
+}
+
+ShaderSpecialization& ShaderSpecialization::set(uint32_t constantId, bool value)
+{
+    const VkBool32 data = value ? VK_TRUE : VK_FALSE;
+    return setData(constantId, &data, sizeof(data));
+}
+
+VkSpecializationInfo ShaderSpecialization::info() const
+{
+    return VkSpecializationInfo{
+        .mapEntryCount = static_cast<uint32_t>(m_entries.size()),
+        .pMapEntries = m_entries.data(),
+        .dataSize = m_data.size(),
+        .pData = m_data.data()
+    };
+}
+
+static std::vector<std::string> sortedDefines(const std::vector<std::string>& defines)
+{
+    std::vector<std::string> sorted = defines;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    return sorted;
+}
+
+std::string shaderDefinesKey(const std::vector<std::string>& defines)
+{
+    std::string key;
+    for(const std::string& define : sortedDefines(defines))
+    {
+        if(!key.empty()) { key.push_back(','); }
+        key += define;
+    }
+    return key;
+}
+
+/* "shaders/VK02.frag" for the plain file, "shaders/VK02.frag:TEXTURED" for a variant */
+static std::string shaderVariantName(const char* file, const std::vector<std::string>& defines)
+{
+    const std::string definesKey = shaderDefinesKey(defines);
+    return definesKey.empty() ? std::string(file) : std::string(file) + ":" + definesKey;
+}
+
+bool saveSPIRVBinaryFile(const char *fileName, const unsigned int *code, size_t size)
 {
-    FILE* file = fopen(fileName, "w");
-    if(!file) return;
+    FILE* file = fopen(fileName, "wb");
+    if(!file) { return false; }
 
-    fwrite(code, sizeof(uint32_t), size, file);
+    const bool bWritten = fwrite(code, sizeof(uint32_t), size, file) == size;
+    return (fclose(file) == 0) && bWritten;
+}
+
+bool loadSPIRVBinaryFile(const char *fileName, std::vector<unsigned int> &code)
+{
+    FILE* file = fopen(fileName, "rb");
+    if(!file) { return false; }
+
+    fseek(file, 0L, SEEK_END);
+    const long bytesinfile = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+
+    bool bValid = bytesinfile > 0 && (bytesinfile % sizeof(uint32_t)) == 0;
+    if(bValid)
+    {
+        code.resize(bytesinfile / sizeof(uint32_t));
+        bValid = fread(code.data(), sizeof(uint32_t), code.size(), file) == code.size() && code[0] == kSPIRVMagic;
+    }
     fclose(file);
+
+    if(!bValid) { code.clear(); }
+    return bValid;
+}
+
+void setShaderCacheDirectory(const char *dir)
+{
+    std::lock_guard<std::mutex> lock(g_shaderCacheMutex);
+    g_shaderCacheDir = dir ? dir : "";
+}
+
+void setShaderOptimization(ShaderOptimization optimization)
+{
+#if !BUILD_WITH_SPIRV_OPT
+    if(optimization != ShaderOptimization::None)
+    {
+        printf("SPIR-V optimization needs BUILD_WITH_SPIRV_OPT, shaders stay unoptimized\n");
+        return;
+    }
+#endif
+    g_shaderOptimization = optimization;
+}
+
+void invalidateShaderSource(const char *fileName)
+{
+    std::lock_guard<std::mutex> lock(g_shaderSourceMutex);
+    g_shaderSources.erase(std::filesystem::path(fileName).lexically_normal().generic_string());
+}
+
+void clearShaderCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(g_shaderSourceMutex);
+        g_shaderSources.clear();
+    }
+    std::lock_guard<std::mutex> lock(g_shaderCacheMutex);
+    g_spirvCache.clear();
 }
 
+#if !BUILD_WITH_EMBEDDED_SHADERS
+
 glslang_stage_t glslsangShaderStageFromFileName(const char* fileName)
 {
     if(endsWith(fileName, ".vert")) { return GLSLANG_STAGE_VERTEX; }
@@ -159,6 +503,7 @@ size_t compileShader(glslang_stage_t stage, const char* shaderSource, ShaderModu
         fprintf(stderr, "\n%s", glslang_shader_get_info_log(shader));
         fprintf(stderr, "\n%s", glslang_shader_get_info_debug_log(shader));
         printShaderSource(input.code);
+        glslang_shader_delete(shader);
         return 0;
     }
 
@@ -168,6 +513,7 @@ size_t compileShader(glslang_stage_t stage, const char* shaderSource, ShaderModu
         fprintf(stderr, "\n%s", glslang_shader_get_info_log(shader));
         fprintf(stderr, "\n%s", glslang_shader_get_info_debug_log(shader));
         printShaderSource(glslang_shader_get_preprocessed_code(shader));
+        glslang_shader_delete(shader);
         return 0;
     }
 
@@ -179,6 +525,8 @@ size_t compileShader(glslang_stage_t stage, const char* shaderSource, ShaderModu
         fprintf(stderr, "GLSL linking failed\n");
         fprintf(stderr, "\n%s", glslang_program_get_info_log(program));
         fprintf(stderr, "\n%s", glslang_program_get_info_debug_log(program));
+        glslang_program_delete(program);
+        glslang_shader_delete(shader);
         return 0;
     }
 
@@ -196,19 +544,276 @@ size_t compileShader(glslang_stage_t stage, const char* shaderSource, ShaderModu
     return shaderModule.SPIRV.size();
 }
 
-size_t compileShaderFile(const char *file, ShaderModule &shaderModule)
+#if BUILD_WITH_SPIRV_OPT
+
+static size_t countSPIRVInstructions(const std::vector<unsigned int>& code)
+{
+    size_t count = 0;
+    // 5 header words, then every instruction starts with its word count in the high half
+    for(size_t i = 5; i < code.size() && (code[i] >> 16); i += code[i] >> 16) { count++; }
+    return count;
+}
+
+/* Runs the recipe on 'code' and reports what it did; 'code' is left alone if the optimizer fails */
+static void optimizeSPIRV(const char* file, ShaderOptimization optimization, std::vector<unsigned int>& code)
+{
+    spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_3);
+    optimizer.SetMessageConsumer([file](spv_message_level_t level, const char*, const spv_position_t& position, const char* message)
+    {
+        if(level <= SPV_MSG_ERROR) { printf("SPIR-V optimizer: '%s' word %zu: %s\n", file, position.index, message); }
+    });
+    if(optimization == ShaderOptimization::Size) { optimizer.RegisterSizePasses(); }
+    else { optimizer.RegisterPerformancePasses(); }
+
+    // the descriptor layouts are reflected from the result and specialization happens at pipeline creation
+    spvtools::OptimizerOptions options;
+    options.set_preserve_bindings(true);
+    options.set_preserve_spec_constants(true);
+
+    std::vector<uint32_t> optimized;
+    const auto start = std::chrono::steady_clock::now();
+    if(!optimizer.Run(code.data(), code.size(), &optimized, options))
+    {
+        printf("SPIR-V optimizer: '%s' failed, keeping the unoptimized SPIR-V\n", file);
+        return;
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    const size_t before = countSPIRVInstructions(code);
+    const size_t after = countSPIRVInstructions(optimized);
+    printf("SPIR-V optimizer: '%s' %s, %zu -> %zu instructions (%+.1f%%), %zu -> %zu bytes, %.2f ms\n",
+        file, optimization == ShaderOptimization::Size ? "size" : "performance",
+        before, after, before ? (100.0 * (static_cast<double>(after) - before) / before) : 0.0,
+        code.size() * sizeof(uint32_t), optimized.size() * sizeof(uint32_t), ms);
+
+    code = std::move(optimized);
+}
+
+#endif
+
+/* Everything the SPIR-V depends on: the expanded source, the stage, the targets passed to glslang and the optimization */
+static uint64_t shaderCacheKey(glslang_stage_t stage, const std::string& source, ShaderOptimization optimization)
+{
+    uint64_t key = hashBytes(source.data(), source.size());
+    key = hashCombine(key, stage);
+    key = hashCombine(key, static_cast<uint32_t>(optimization));
+    key = hashCombine(key, GLSLANG_TARGET_VULKAN_1_3);
+    key = hashCombine(key, GLSLANG_TARGET_SPV_1_3);
+    key = hashCombine(key, kShaderCacheVersion);
+    return key;
+}
+
+static std::string shaderCacheFile(const std::string& dir, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(dir) / name).string();
+}
+
+/* Adds a #define per entry of 'defines' right after the #version line, which has to stay first */
+static bool applyShaderDefines(const char *file, const std::vector<std::string>& defines, std::string& source)
+{
+    std::string block;
+    for(const std::string& define : sortedDefines(defines))
+    {
+        const size_t equals = define.find('=');
+        const std::string_view name = std::string_view(define).substr(0, equals);
+        if(name.empty() || firstWord(name) != name || isdigit(static_cast<unsigned char>(name.front())))
+        {
+            printf("Error while loading shader program '%s': '%s' is not a valid define\n", file, define.c_str());
+            return false;
+        }
+        block += "#define " + std::string(name) + " " + (equals == define.npos ? std::string("1") : define.substr(equals + 1)) + "\n";
+    }
+    if(block.empty()) { return true; }
+
+    size_t insertAt = 0;
+    uint32_t lineNumber = 0;
+    forEachLine(source, [&](std::string_view line)
+    {
+        lineNumber++;
+        if(!insertAt && directiveName(line) == "version")
+        {
+            insertAt = static_cast<size_t>(line.data() - source.data()) + line.size();
+            insertAt = source.find('\n', insertAt);
+            insertAt = (insertAt == source.npos) ? source.size() : insertAt + 1;
+            // messages keep the line numbers of the file
+            block += "#line " + std::to_string(lineNumber + 1) + " 0\n";
+        }
+    });
+    if(!insertAt) { block += "#line 1 0\n"; }
+
+    source.insert(insertAt, block);
+    return true;
+}
+
+static size_t compileShaderFileCached(const char *file, ShaderModule &shaderModule, const std::vector<std::string>& defines)
 {
     std::string shaderSource = readShaderFile(file);
-    if(!shaderSource.empty())
+    if(shaderSource.empty() || !applyShaderDefines(file, defines, shaderSource)) { return 0; }
+
+    const glslang_stage_t stage = glslsangShaderStageFromFileName(file);
+    const ShaderOptimization optimization = g_shaderOptimization;
+    const uint64_t key = shaderCacheKey(stage, shaderSource, optimization);
+
+    std::string cacheDir;
+    {
+        std::lock_guard<std::mutex> lock(g_shaderCacheMutex);
+        const auto it = g_spirvCache.find(key);
+        if(it != g_spirvCache.end())
+        {
+            shaderModule.SPIRV = it->second;
+            return shaderModule.SPIRV.size();
+        }
+        cacheDir = g_shaderCacheDir;
+    }
+
+    const std::string cacheFile = cacheDir.empty() ? std::string() : shaderCacheFile(cacheDir, key);
+    if(cacheFile.empty() || !loadSPIRVBinaryFile(cacheFile.c_str(), shaderModule.SPIRV))
+    {
+        if(!compileShader(stage, shaderSource.c_str(), shaderModule)) { return 0; }
+#if BUILD_WITH_SPIRV_OPT
+        if(optimization != ShaderOptimization::None) { optimizeSPIRV(file, optimization, shaderModule.SPIRV); }
+#endif
+
+        if(!cacheFile.empty())
+        {
+            // written under a unique name and renamed, so concurrent writers and crashes never leave a partial entry
+            static std::atomic<uint32_t> tmpCounter = 0;
+            const std::string tmpFile = cacheFile + "." + std::to_string(tmpCounter++) + ".tmp";
+
+            std::error_code ec;
+            std::filesystem::create_directories(cacheDir, ec);
+            if(saveSPIRVBinaryFile(tmpFile.c_str(), shaderModule.SPIRV.data(), shaderModule.SPIRV.size()))
+            {
+                std::filesystem::rename(tmpFile, cacheFile, ec);
+            }
+            // a cache that cannot be written only costs the next run a compile
+            std::filesystem::remove(tmpFile, ec);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(g_shaderCacheMutex);
+    g_spirvCache.emplace(key, shaderModule.SPIRV);
+    return shaderModule.SPIRV.size();
+}
+
+size_t compileShaderFile(const char *file, ShaderModule &shaderModule, const std::vector<std::string>& defines)
+{
+    std::shared_future<size_t> pending;
+    {
+        std::lock_guard<std::mutex> lock(g_shaderCacheMutex);
+        const auto it = g_pendingShaders.find(shaderVariantName(file, defines));
+        if(it != g_pendingShaders.end()) { pending = it->second; }
+    }
+    // the queued compile has already reported its errors
+    if(pending.valid() && !pending.get()) { return 0; }
+
+    return compileShaderFileCached(file, shaderModule, defines);
+}
+
+std::vector<std::shared_future<size_t>> compileShaderFilesAsync(ThreadPool &pool, const std::vector<ShaderVariant> &shaders)
+{
+    // glslang is initialized once for the batch and finalized by whichever compile finishes last;
+    // the calls are reference counted, so this nests with the initialization in main()
+    struct Batch
+    {
+        std::atomic<size_t> remaining = 0;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->remaining = shaders.size();
+    if(!shaders.empty()) { glslang_initialize_process(); }
+
+    std::vector<std::shared_future<size_t>> results;
+    results.reserve(shaders.size());
+
+    std::lock_guard<std::mutex> lock(g_shaderCacheMutex);
+    for(const ShaderVariant& shader : shaders)
+    {
+        const std::string name = shaderVariantName(shader.file.c_str(), shader.defines);
+        const auto it = g_pendingShaders.find(name);
+        if(it != g_pendingShaders.end())
+        {
+            results.push_back(it->second);
+            if(batch->remaining.fetch_sub(1) == 1) { glslang_finalize_process(); }
+            continue;
+        }
+
+        auto task = std::make_shared<std::packaged_task<size_t()>>([fileName = shader.file, defines = shader.defines, name, batch]()
+        {
+            ShaderModule module;
+            const size_t size = compileShaderFileCached(fileName.c_str(), module, defines);
+            {
+                std::lock_guard<std::mutex> lock(g_shaderCacheMutex);
+                g_pendingShaders.erase(name);
+            }
+            if(batch->remaining.fetch_sub(1) == 1) { glslang_finalize_process(); }
+            return size;
+        });
+
+        std::shared_future<size_t> result = task->get_future().share();
+        g_pendingShaders.emplace(name, result);
+        results.push_back(result);
+        pool.submit([task]() { (*task)(); });
+    }
+    return results;
+}
+
+#else
+
+// generated by tools/ShaderCompiler: kEmbeddedShaders[]
+#include "EmbeddedShaders.inl"
+
+const EmbeddedShader* findEmbeddedShader(const char *fileName, const std::vector<std::string>& defines)
+{
+    const std::string name = std::filesystem::path(fileName).lexically_normal().generic_string();
+    const std::string definesKey = shaderDefinesKey(defines);
+    for(const EmbeddedShader& shader : kEmbeddedShaders)
+    {
+        if(name == shader.fileName && definesKey == shader.defines) { return &shader; }
+    }
+    return nullptr;
+}
+
+VkShaderStageFlagBits getVkShaderStageFromFileName(const char *fileName)
+{
+    const EmbeddedShader* shader = findEmbeddedShader(fileName);
+    return shader ? shader->stage : VK_SHADER_STAGE_VERTEX_BIT;
+}
+
+size_t compileShaderFile(const char *file, ShaderModule &shaderModule, const std::vector<std::string>& defines)
+{
+    const EmbeddedShader* shader = findEmbeddedShader(file, defines);
+    if(!shader)
     {
-        return compileShader(glslsangShaderStageFromFileName(file), shaderSource.c_str(), shaderModule);
+        // variants are compiled in only when listed for tools/ShaderCompiler
+        printf("Shader '%s' was not compiled into the application\n", shaderVariantName(file, defines).c_str());
+        return 0;
     }
-    return 0;
+    shaderModule.SPIRV.assign(shader->spirv, shader->spirv + shader->spirvSize);
+    return shaderModule.SPIRV.size();
 }
 
-VkResult createShaderModule(VkDevice device, ShaderModule *sm, const char *fileName)
+std::vector<std::shared_future<size_t>> compileShaderFilesAsync(ThreadPool &, const std::vector<ShaderVariant> &shaders)
+{
+    // everything was compiled at build time, the results are ready right away
+    std::vector<std::shared_future<size_t>> results;
+    results.reserve(shaders.size());
+    for(const ShaderVariant& variant : shaders)
+    {
+        const EmbeddedShader* shader = findEmbeddedShader(variant.file.c_str(), variant.defines);
+        std::promise<size_t> result;
+        result.set_value(shader ? shader->spirvSize : 0);
+        results.push_back(result.get_future().share());
+    }
+    return results;
+}
+
+#endif
+
+VkResult createShaderModule(VkDevice device, ShaderModule *sm, const char *fileName, const std::vector<std::string>& defines)
 {
-    if(!compileShaderFile(fileName, *sm)) { return VK_NOT_READY; }
+    if(!compileShaderFile(fileName, *sm, defines)) { return VK_NOT_READY; }
 
     const VkShaderModuleCreateInfo createInfo =
     {
@@ -1,36 +1,136 @@
 #pragma once
 
 #include <vulkan/vulkan.h>
+#if !BUILD_WITH_EMBEDDED_SHADERS
 #include <glslang/Include/glslang_c_shader_types.h>
+#endif
 
+#include <future>
 #include <string>
+#include <utility>
 #include <vector>
 
+class ThreadPool;
+
 struct ShaderModule
 {
     std::vector<unsigned int> SPIRV;
     VkShaderModule ShaderModule = nullptr;
 };
 
+/* Values of the specialization constants of one stage by constant_id; applied when the pipeline is created */
+class ShaderSpecialization
+{
+public:
+
+    ShaderSpecialization& set(uint32_t constantId, uint32_t value);
+    ShaderSpecialization& set(uint32_t constantId, int32_t value);
+    ShaderSpecialization& set(uint32_t constantId, float value);
+    // GLSL bools are 32-bit
+    ShaderSpecialization& set(uint32_t constantId, bool value);
+
+    inline bool empty() const { return m_entries.empty(); }
+
+    /* Points into this object: valid while it is alive and not changed */
+    VkSpecializationInfo info() const;
+
+private:
+
+    ShaderSpecialization& setData(uint32_t constantId, const void* value, size_t size);
+
+    std::vector<VkSpecializationMapEntry> m_entries;
+    std::vector<uint8_t> m_data;
+};
+
+/**
+ * One permutation of a shader file. The defines ("NAME" or "NAME=VALUE") are compiled into their own SPIR-V, cached by
+ * the define set; the specialization constants reuse the SPIR-V of the file and are set at pipeline creation.
+ */
+struct ShaderVariant
+{
+    ShaderVariant(const char* fileName, std::vector<std::string> variantDefines = {}, ShaderSpecialization variantSpecialization = {}) :
+        file(fileName),
+        defines(std::move(variantDefines)),
+        specialization(std::move(variantSpecialization))
+    {}
+
+    std::string file;
+    std::vector<std::string> defines;
+    ShaderSpecialization specialization;
+};
+
 int endsWith(const char* s, const char* part);
 
-std::string readShaderFile(const char* fileName);
+/**
+ * Reads a shader and expands its #includes. Every file is read from disk once per process, headers with an
+ * include guard or '#pragma once' are pasted once, and #line directives keep compiler messages pointing at the
+ * original files: source string N is dependencies[N], 0 being 'fileName' itself.
+ */
+std::string readShaderFile(const char* fileName, std::vector<std::string>* dependencies = nullptr);
 
 void printShaderSource(const char* text);
 
+/* The define set of a variant in one canonical spelling, sorted and comma separated: "SKINNED,TEXTURED=1" */
+std::string shaderDefinesKey(const std::vector<std::string>& defines);
+
+#if !BUILD_WITH_EMBEDDED_SHADERS
 glslang_stage_t glslsangShaderStageFromFileName(const char* fileName);
 
 VkShaderStageFlagBits glslangShaderStageToVulkan(glslang_stage_t stage);
 
+size_t compileShader(glslang_stage_t stage, const char* shaderSource, ShaderModule& shaderModule);
+#endif
+
 VkShaderStageFlagBits getVkShaderStageFromFileName(const char* fileName);
 
-size_t compileShaderFile(const char* file, ShaderModule& shaderModule);
+/**
+ * Compiles a shader file to SPIR-V, going through the shader caches first.
+ * SPIR-V is keyed by the hash of the include-expanded source, the stage and the target versions; a key found in
+ * memory or in the cache directory skips glslang completely, so renderers sharing a shader compile it once.
+ * 'defines' are inserted after the #version line, which puts them into the key as well.
+ * With BUILD_WITH_EMBEDDED_SHADERS the SPIR-V compiled at build time is returned instead, nothing is read from disk.
+ */
+size_t compileShaderFile(const char* file, ShaderModule& shaderModule, const std::vector<std::string>& defines = {});
+
+/**
+ * Queues 'shaders' for compilation on the pool and returns right away; each future yields the SPIR-V size, 0 on failure.
+ * compileShaderFile() on a queued variant waits for its future and then takes the result from the shader cache,
+ * so pipeline creation needs no changes. The pool has to outlive the futures.
+ */
+std::vector<std::shared_future<size_t>> compileShaderFilesAsync(ThreadPool& pool, const std::vector<ShaderVariant>& shaders);
+
+/* Directory of the on-disk SPIR-V cache, created on demand; an empty string disables it. Default: "shader_cache" */
+void setShaderCacheDirectory(const char* dir);
+
+/* SPIRV-Tools optimization recipes, run on the SPIR-V glslang produces */
+enum class ShaderOptimization
+{
+    None,
+    Performance,
+    Size
+};
+
+/**
+ * Recipe for every shader compiled from now on, None by default. The recipe is part of the cache key, so a shader
+ * is optimized once and later runs load the result. Each optimization prints the instruction count before and after
+ * and the time it took. Descriptor bindings and specialization constants are kept. Needs BUILD_WITH_SPIRV_OPT.
+ */
+void setShaderOptimization(ShaderOptimization optimization);
+
+/* Makes the next readShaderFile() that needs 'fileName' read it from disk again */
+void invalidateShaderSource(const char* fileName);
+
+/* Drops the SPIR-V and the shader sources kept in memory; the on-disk cache is left alone */
+void clearShaderCache();
+
+bool saveSPIRVBinaryFile(const char* fileName, const unsigned int* code, size_t size);
 
-void saveSPIRVBinaryFile(const char* fileName, unsigned int* code, size_t size);
+/* Reads a SPIR-V binary; false if the file is missing or is not SPIR-V */
+bool loadSPIRVBinaryFile(const char* fileName, std::vector<unsigned int>& code);
 
-VkResult createShaderModule(VkDevice device, ShaderModule* sm, const char* fileName);
+VkResult createShaderModule(VkDevice device, ShaderModule* sm, const char* fileName, const std::vector<std::string>& defines = {});
 
-inline VkPipelineShaderStageCreateInfo shaderStageInfo(VkShaderStageFlagBits shaderStage, ShaderModule& module, const char* entryPoint)
+inline VkPipelineShaderStageCreateInfo shaderStageInfo(VkShaderStageFlagBits shaderStage, ShaderModule& module, const char* entryPoint, const VkSpecializationInfo* specialization = nullptr)
 {
 	return VkPipelineShaderStageCreateInfo{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -39,6 +139,6 @@ inline VkPipelineShaderStageCreateInfo shaderStageInfo(VkShaderStageFlagBits sha
 		.stage = shaderStage,
 		.module = module.ShaderModule,
 		.pName = entryPoint,
-		.pSpecializationInfo = nullptr
+		.pSpecializationInfo = specialization
 	};
 }
\ No newline at end of file
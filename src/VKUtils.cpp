@@ -2,6 +2,8 @@
 #include "VKShader.h"
 #include "Bitmap.h"
 #include "UtilsCubemap.h"
+#include "VtxData.h"
+#include "UtilsThreadPool.h"
 #include "vk_exts/vk_exts.h"
 
 // #include <volk/volk.h>
@@ -13,11 +15,6 @@
 
 #include <stb/stb_image.h>
 
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
-#include <assimp/cimport.h>
-#include <assimp/version.h>
-
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
@@ -232,6 +229,13 @@ VkResult createDevice(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures2
     return vkCreateDevice(physicalDevice, &ci, nullptr, device);
 }
 
+bool hasIndirectDrawFeatures(VkPhysicalDevice device)
+{
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(device, &features);
+    return features.multiDrawIndirect == VK_TRUE && features.drawIndirectFirstInstance == VK_TRUE;
+}
+
 bool isDeviceSuitable(VkPhysicalDevice device)
 {
     VkPhysicalDeviceProperties deviceProperties;
@@ -249,7 +253,7 @@ bool isDeviceSuitable(VkPhysicalDevice device)
     const bool isIntegratedGPU = deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU;
     const bool isGPU = isDiscreteGPU || isIntegratedGPU;
 
-    return isGPU && deviceFeatures.features.geometryShader && shaderDrawParamFeatures.shaderDrawParameters;
+    return isGPU && deviceFeatures.features.geometryShader && shaderDrawParamFeatures.shaderDrawParameters && hasIndirectDrawFeatures(device);
 }
 
 VkResult findSuitablePhysicalDevice(VkInstance instance, std::function<bool(VkPhysicalDevice)> selector, VkPhysicalDevice *physicalDevice)
@@ -1160,13 +1164,23 @@ uint32_t bytesPerTexFormat(VkFormat fmt)
     return 0;
 }
 
+VkDeviceSize alignStorageBufferOffset(VulkanRenderDevice &vkDev, VkDeviceSize offset)
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vkDev.physicalDevice, &props);
+    const VkDeviceSize alignment = props.limits.minStorageBufferOffsetAlignment;
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
 size_t allocateVertexBuffer(
     VulkanRenderDevice &vkDev,
     VkBuffer *storageBuffer, VkDeviceMemory *storageBufferMemory,
     size_t vertexDataSize, const void *vertexData, 
     size_t indexDataSize, const void *indexData)
 {
-    VkDeviceSize bufferSize = vertexDataSize + indexDataSize;
+    // the index data is bound as a storage buffer at this offset
+    const VkDeviceSize indexDataOffset = alignStorageBufferOffset(vkDev, vertexDataSize);
+    VkDeviceSize bufferSize = indexDataOffset + indexDataSize;
 
     VkBuffer stagingBuffer;
     VkDeviceMemory stagingBufferMemory;
@@ -1180,7 +1194,8 @@ size_t allocateVertexBuffer(
     void* data;
     vkMapMemory(vkDev.device, stagingBufferMemory, 0, bufferSize, 0, &data);
         memcpy(data, vertexData, vertexDataSize);
-        memcpy((unsigned char*)data + vertexDataSize, indexData, indexDataSize);
+        memset((unsigned char*)data + vertexDataSize, 0, indexDataOffset - vertexDataSize);
+        memcpy((unsigned char*)data + indexDataOffset, indexData, indexDataSize);
     vkUnmapMemory(vkDev.device, stagingBufferMemory);
 
     createBuffer(
@@ -1197,53 +1212,34 @@ size_t allocateVertexBuffer(
     return bufferSize;
 }
 
-bool createTexturedVertexBuffer(
+bool createMeshFileVertexBuffer(
     VulkanRenderDevice &vkDev,
-    const char *fileName,
+    const char *meshFile,
     VkBuffer *storageBuffer, VkDeviceMemory *storageBufferMemory, size_t *vertexBufferSize,
-    size_t *indexBufferSize)
+    size_t *indexBufferSize, std::vector<Mesh>* outMeshes)
 {
-    const aiScene* scene = aiImportFile(fileName, aiProcess_Triangulate);
-    if(!scene || !scene->HasMeshes())
-    {
-        printf("Unable to load %s\n", fileName);
-        exit(255);
-    }
-
-    const aiMesh* mesh = scene->mMeshes[0];
-    struct VertexData
-    {
-        vec3 pos;
-        vec2 tc;
-    };
-
-    std::vector<VertexData> vertices;
-    for(unsigned int i = 0; i != mesh->mNumVertices; i++)
-    {
-        const aiVector3D v = mesh->mVertices[i];
-        const aiVector3D t = mesh->mTextureCoords[0][i];
-        vertices.push_back({ .pos = vec3(v.x, v.z, v.y), .tc = vec2(t.x, 1.0f-t.y) });
-    }
+    // compressed blocks are decoded on all cores
+    ThreadPool loadPool;
+    MeshFileView view;
+    if(!mapMeshFile(meshFile, view, false, &loadPool)) { return false; }
 
-    std::vector<unsigned int> indices;
-    for(unsigned int i = 0; i != mesh->mNumFaces; i++)
+    if(outMeshes)
     {
-        for(unsigned j = 0; j != 3; j++)
-        {
-            indices.push_back(mesh->mFaces[i].mIndices[j]);
-        }
+        outMeshes->assign(view.meshes.begin(), view.meshes.end());
     }
-    aiReleaseImport(scene);
 
-    *vertexBufferSize = sizeof(VertexData)* vertices.size();
-    *indexBufferSize = sizeof(unsigned int)* indices.size();
+    *indexBufferSize = view.indexData.size_bytes();
 
+    // uncompressed blocks are copied straight from the mapping into the staging buffer
     allocateVertexBuffer(
-        vkDev, 
-        storageBuffer, storageBufferMemory, 
-        *vertexBufferSize, vertices.data(), 
-        *indexBufferSize, indices.data()
+        vkDev,
+        storageBuffer, storageBufferMemory,
+        view.vertexData.size_bytes(), view.vertexData.data(),
+        *indexBufferSize, view.indexData.data()
     );
+    *vertexBufferSize = alignStorageBufferOffset(vkDev, view.vertexData.size_bytes());
+
+    unmapMeshFile(view);
 
     return true;
 }
@@ -1634,21 +1630,33 @@ bool createColorAndDepthFramebuffers(VulkanRenderDevice &vkDev, VkRenderPass ren
 // }
 
 bool createGraphicsPipeline(VulkanRenderDevice &vkDev, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const std::vector<const char *> &shaderFiles, VkPipeline *pipeline, VkPrimitiveTopology topology, bool useDepth, bool useBlending, bool dynamicScissorState, int32_t customWidth, int32_t customHeight, uint32_t numPatchControlPoints)
+{
+    const std::vector<ShaderVariant> shaders(shaderFiles.begin(), shaderFiles.end());
+    return createGraphicsPipeline(
+        vkDev, renderPass, pipelineLayout, shaders, pipeline,
+        topology, useDepth, useBlending, dynamicScissorState, customWidth, customHeight, numPatchControlPoints);
+}
+
+bool createGraphicsPipeline(VulkanRenderDevice &vkDev, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const std::vector<ShaderVariant> &shaders, VkPipeline *pipeline, VkPrimitiveTopology topology, bool useDepth, bool useBlending, bool dynamicScissorState, int32_t customWidth, int32_t customHeight, uint32_t numPatchControlPoints)
 {
     std::vector<ShaderModule> shaderModules;
     std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+    // pointed to by shaderStages, sized up front
+    std::vector<VkSpecializationInfo> specializations;
 
-    shaderModules.resize(shaderFiles.size());
-    shaderStages.resize(shaderFiles.size());
+    shaderModules.resize(shaders.size());
+    shaderStages.resize(shaders.size());
+    specializations.resize(shaders.size());
 
-    for(size_t i = 0; i < shaderFiles.size(); i++)
+    for(size_t i = 0; i < shaders.size(); i++)
     {
-        const char* file = shaderFiles[i];
-        VK_CHECK(createShaderModule(vkDev.device, &shaderModules[i], file));
+        const ShaderVariant& shader = shaders[i];
+        VK_CHECK(createShaderModule(vkDev.device, &shaderModules[i], shader.file.c_str(), shader.defines));
 
-        VkShaderStageFlagBits stage = getVkShaderStageFromFileName(file);
+        VkShaderStageFlagBits stage = getVkShaderStageFromFileName(shader.file.c_str());
 
-        shaderStages[i] = shaderStageInfo(stage, shaderModules[i], "main");
+        specializations[i] = shader.specialization.info();
+        shaderStages[i] = shaderStageInfo(stage, shaderModules[i], "main", shader.specialization.empty() ? nullptr : &specializations[i]);
     }
 
     const VkPipelineVertexInputStateCreateInfo vertexInputInfo =
@@ -101,6 +101,9 @@ void createInstance(VkInstance *instance);
 
 VkResult createDevice(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures2 deviceFeatures, uint32_t graphicsFamily, VkDevice *device);
 
+/* multiDrawIndirect and drawIndirectFirstInstance: renderers issue indirect draws that select a mesh with firstInstance */
+bool hasIndirectDrawFeatures(VkPhysicalDevice device);
+
 bool isDeviceSuitable(VkPhysicalDevice device);
 
 VkResult findSuitablePhysicalDevice(VkInstance instance, std::function<bool(VkPhysicalDevice)> selector, VkPhysicalDevice *physicalDevice);
@@ -253,17 +256,28 @@ bool createCubeTextureImage(
 
 uint32_t bytesPerTexFormat(VkFormat fmt);
 
+/* Rounds 'offset' up to minStorageBufferOffsetAlignment */
+VkDeviceSize alignStorageBufferOffset(VulkanRenderDevice& vkDev, VkDeviceSize offset);
+
+/* Vertex data followed by index data, which starts at alignStorageBufferOffset(vertexDataSize) */
 size_t allocateVertexBuffer(
     VulkanRenderDevice& vkDev, 
     VkBuffer* storageBuffer, VkDeviceMemory* storageBufferMemory, 
     size_t vertexDataSize, const void* vertexData, 
     size_t indexDataSize, const void* indexData);
 
-bool createTexturedVertexBuffer(
+struct Mesh;
+struct ShaderVariant;
+
+/**
+ * Uploads index and vertex blocks of a converted mesh file straight from its memory mapping.
+ * '*vertexBufferSize' includes the padding up to the index data, so it is also the offset of the index data.
+ */
+bool createMeshFileVertexBuffer(
     VulkanRenderDevice& vkDev,
-    const char* fileName,
-    VkBuffer* storageBuffer, VkDeviceMemory* storageBufferMemory, size_t* vertexBufferSize, 
-    size_t* indexBufferSize);
+    const char* meshFile,
+    VkBuffer* storageBuffer, VkDeviceMemory* storageBufferMemory, size_t* vertexBufferSize,
+    size_t* indexBufferSize, std::vector<Mesh>* outMeshes = nullptr);
 
 bool createDescriptorPool(
     VulkanRenderDevice& vkDev, 
@@ -391,3 +405,17 @@ bool createGraphicsPipeline(
     int32_t customWidth = -1,
     int32_t customHeight = -1,
     uint32_t numPatchControlPoints = 0);
+
+/* Same, with the defines and specialization constants of every stage */
+bool createGraphicsPipeline(
+    VulkanRenderDevice& vkDev,
+    VkRenderPass renderPass, VkPipelineLayout pipelineLayout,
+    const std::vector<ShaderVariant>& shaders,
+    VkPipeline* pipeline,
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+    bool useDepth = true,
+    bool useBlending = true,
+    bool dynamicScissorState = false,
+    int32_t customWidth = -1,
+    int32_t customHeight = -1,
+    uint32_t numPatchControlPoints = 0);
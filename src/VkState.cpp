@@ -1,6 +1,7 @@
 #include "VkState.h"
 
 #include "ProfilerWrapper.h"
+#include "UtilsThreadPool.h"
 
 // VulkanState vkState;
 VulkanInstance vk;
@@ -17,6 +18,8 @@ std::unique_ptr<VulkanCanvas> vk_canvas2d;
 std::unique_ptr<VulkanClear> vk_clear;
 std::unique_ptr<VulkanFinish> vk_finish;
 
+std::unique_ptr<ShaderHotReload> shaderHotReload;
+
 FramesPerSecondCounter fpsCounter(0.2f);
 LinearGraph fpsGraph;
 LinearGraph sineGraph(4096);
@@ -45,6 +48,8 @@ bool initVulkan(GLFWwindow* window, uint32_t width, uint32_t height)
 
     VkPhysicalDeviceFeatures deviceFeatures1{};
     deviceFeatures1.geometryShader = VK_TRUE;
+    deviceFeatures1.multiDrawIndirect = VK_TRUE;
+    deviceFeatures1.drawIndirectFirstInstance = VK_TRUE;
     VkPhysicalDeviceShaderDrawParameterFeatures drawParamFeatures{};
     drawParamFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETER_FEATURES;
     drawParamFeatures.shaderDrawParameters = VK_TRUE;
@@ -57,6 +62,25 @@ bool initVulkan(GLFWwindow* window, uint32_t width, uint32_t height)
     if(!initVulkanRenderDevice(vk, vkDev, width, height, isDeviceSuitable, deviceFeatures ) )
         { exit(EXIT_FAILURE); }
 
+#if BUILD_WITH_SPIRV_OPT
+    // recipe chosen with SPIRV_OPT_RECIPE in CMake
+#if SPIRV_OPT_SIZE
+    setShaderOptimization(ShaderOptimization::Size);
+#else
+    setShaderOptimization(ShaderOptimization::Performance);
+#endif
+#endif
+
+    // shaders of all renderers compile concurrently, each constructor only waits for the ones it uses
+    ThreadPool shaderPool;
+    compileShaderFilesAsync(shaderPool,
+    {
+        "shaders/ImGui.vert", "shaders/ImGui.frag",
+        "shaders/VK02.vert", { "shaders/VK02.frag", { "TEXTURED" } }, "shaders/VK02.geom",
+        "shaders/VKCube.vert", "shaders/VKCube.frag",
+        "shaders/Lines.vert", "shaders/Lines.frag"
+    });
+
     vk_imgui = std::make_unique<VulkanImGui>(vkDev);
     vk_model_renderer = std::make_unique<VulkanModelRenderer>(vkDev, "assets/meshes/rubber_duck/scene.gltf", "assets/meshes/rubber_duck/textures/Duck_baseColor.png", (uint32_t)sizeof(glm::mat4));
     vk_cube_renderer = std::make_unique<VulkanCubeRenderer>(vkDev, vk_model_renderer->getDepthTexture(), "assets/piazza_bologni_1k.hdr");
@@ -74,11 +98,27 @@ bool initVulkan(GLFWwindow* window, uint32_t width, uint32_t height)
        }
     }
 
+#if !BUILD_WITH_EMBEDDED_SHADERS
+    // embedded shaders have no sources to watch
+    shaderHotReload = std::make_unique<ShaderHotReload>(vkDev);
+    const std::vector<VulkanRendererBase*> reloadable =
+    {
+        vk_imgui.get(), vk_model_renderer.get(), vk_cube_renderer.get(), vk_canvas.get(), vk_canvas2d.get()
+    };
+    for(VulkanRendererBase* renderer : reloadable)
+    {
+        shaderHotReload->addRenderer(renderer);
+    }
+#endif
+
     return true;
 }
 
 void terminateVulkan()
 {
+    // stops the watcher thread before the renderers it rebuilds go away
+    shaderHotReload = nullptr;
+
     vk_canvas = nullptr;
     vk_canvas2d = nullptr;
     vk_finish = nullptr;
@@ -87,6 +127,9 @@ void terminateVulkan()
     vk_model_renderer = nullptr;
     vk_imgui = nullptr;
 
+    // shared by the renderers' pipeline layouts
+    destroyDescriptorSetLayouts(vkDev.device);
+
     destroyVulkanRenderDevice(vkDev);
     destroyVulkanInstance(vk);
 }
@@ -191,11 +234,14 @@ void update3D(GLFWwindow *window, uint32_t imageIndex)
 
     const mat4 view = camera.getViewMatrix();
     const mat4 mtx = p * view * m1;
+    // the .mesh file is pre-transformed by the glTF root node, (x, z, -y) of the source positions;
+    // mirroring Z restores the (x, z, y) placement the model always had
+    const mat4 modelMtx = mtx * glm::scale(mat4(1.0f), vec3(1.0f, 1.0f, -1.0f));
 
     {
         // EASY_BLOCK("UpdateUniformBuffers");
 
-            vk_model_renderer->updateUniformBuffer(vkDev, imageIndex, glm::value_ptr(mtx), sizeof(mat4));
+            vk_model_renderer->updateUniformBuffer(vkDev, imageIndex, glm::value_ptr(modelMtx), sizeof(mat4));
             vk_canvas->updateUniformBuffer(vkDev, p * view, 0.0f, imageIndex);
             vk_canvas2d->updateUniformBuffer(vkDev, glm::ortho(0, 1, 1, 0), 0.0f, imageIndex);
             vk_cube_renderer->updateUniformBuffer(vkDev, imageIndex, mtx);
@@ -245,6 +291,9 @@ bool drawFrame(GLFWwindow *window, const std::vector<VulkanRendererBase *> &rend
 {
     // EASY_FUNCTION();
 
+    // the previous frame has finished (vkDeviceWaitIdle below), so no command buffer uses a replaced pipeline
+    if(shaderHotReload) { shaderHotReload->update(); }
+
     uint32_t imageIndex = 0;
     VkResult result = vkAcquireNextImageKHR(vkDev.device, vkDev.swapchain, 0, vkDev.semaphore, VK_NULL_HANDLE, &imageIndex);
     VK_CHECK(vkResetCommandPool(vkDev.device, vkDev.commandPool, 0));
@@ -11,6 +11,7 @@
 #include "VulkanCanvas.h"
 #include "VulkanModelRenderer.h"
 #include "VulkanCubeRenderer.h"
+#include "ShaderHotReload.h"
 
 #include "LinearGraph.h"
 
@@ -42,6 +43,8 @@ extern std::unique_ptr<VulkanCanvas> vk_canvas2d;
 extern std::unique_ptr<VulkanClear> vk_clear;
 extern std::unique_ptr<VulkanFinish> vk_finish;
 
+extern std::unique_ptr<ShaderHotReload> shaderHotReload;
+
 static constexpr VkClearColorValue clearColorValue = { 1.0f, 1.0f, 1.0f, 1.0f };
 
 extern FramesPerSecondCounter fpsCounter;
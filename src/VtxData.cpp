@@ -0,0 +1,1077 @@
+#include "VtxData.h"
+#include "UtilsHash.h"
+#include "UtilsMappedFile.h"
+#include "UtilsThreadPool.h"
+
+#include <meshoptimizer.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+
+
+uint64_t meshDataChecksum(
+    std::span<const Mesh> meshes, std::span<const uint8_t> indexData, std::span<const uint8_t> vertexData,
+    std::span<const Meshlet> meshlets, std::span<const uint32_t> meshletVertices, std::span<const uint8_t> meshletTriangles,
+    std::span<const MeshBounds> bounds)
+{
+    // sections are hashed independently so MeshFileWriter can hash them while streaming
+    uint64_t h = hashBytes(meshes.data(), meshes.size_bytes());
+    h = hashCombine(h, hashBytes(indexData.data(), indexData.size_bytes()));
+    h = hashCombine(h, hashBytes(vertexData.data(), vertexData.size_bytes()));
+    h = hashCombine(h, hashBytes(meshlets.data(), meshlets.size_bytes()));
+    h = hashCombine(h, hashBytes(meshletVertices.data(), meshletVertices.size_bytes()));
+    h = hashCombine(h, hashBytes(meshletTriangles.data(), meshletTriangles.size_bytes()));
+    h = hashCombine(h, hashBytes(bounds.data(), bounds.size_bytes()));
+    return h;
+}
+
+uint32_t vertexAttributeSize(uint32_t encoding, uint32_t components)
+{
+    switch(encoding)
+    {
+        case eVertexEncoding_Float32:
+            return components * sizeof(float);
+        case eVertexEncoding_Half:
+        case eVertexEncoding_Unorm16:
+            // rounded up to whole 32-bit words
+            return ((components + 1) / 2) * sizeof(uint32_t);
+        case eVertexEncoding_Octahedral16:
+            return sizeof(uint32_t);
+        default:
+            return 0;
+    }
+}
+
+uint32_t vertexFormatStride(const VertexFormat& fmt)
+{
+    return
+        vertexAttributeSize(fmt.position, 3) +
+        vertexAttributeSize(fmt.texCoord, 2) +
+        vertexAttributeSize(fmt.normal, 3);
+}
+
+uint32_t vertexFormatStreamCount(const VertexFormat& fmt)
+{
+    const bool hasAttributes = fmt.texCoord != eVertexEncoding_None || fmt.normal != eVertexEncoding_None;
+    return (fmt.layout == eVertexLayout_Split && hasAttributes) ? 2 : 1;
+}
+
+uint32_t vertexFormatStreamStride(const VertexFormat& fmt, uint32_t stream)
+{
+    if(vertexFormatStreamCount(fmt) == 1)
+    {
+        return (stream == 0) ? vertexFormatStride(fmt) : 0;
+    }
+    const uint32_t positionSize = vertexAttributeSize(fmt.position, 3);
+    return (stream == 0) ? positionSize : (stream == 1) ? vertexFormatStride(fmt) - positionSize : 0;
+}
+
+uint32_t vertexFormatFloatCount(const VertexFormat& fmt)
+{
+    return 3 + (fmt.texCoord != eVertexEncoding_None ? 2 : 0) + (fmt.normal != eVertexEncoding_None ? 3 : 0);
+}
+
+GPUVertexFormat gpuVertexFormat(const Mesh& mesh)
+{
+    const VertexFormat& fmt = mesh.vertexFormat;
+    const uint32_t wordSize = static_cast<uint32_t>(sizeof(uint32_t));
+    const bool bSplit = vertexFormatStreamCount(fmt) == 2;
+    const uint32_t vertexBase = static_cast<uint32_t>(mesh.streamOffset[0] / wordSize);
+
+    return GPUVertexFormat
+    {
+        .positionOffset = { fmt.positionOffset[0], fmt.positionOffset[1], fmt.positionOffset[2], 0.0f },
+        .positionScale = { fmt.positionScale[0], fmt.positionScale[1], fmt.positionScale[2], 0.0f },
+        .texCoordOffsetScale = { fmt.texCoordOffset[0], fmt.texCoordOffset[1], fmt.texCoordScale[0], fmt.texCoordScale[1] },
+        .position = fmt.position,
+        .texCoord = fmt.texCoord,
+        .normal = fmt.normal,
+        .stride = vertexFormatStreamStride(fmt, 0) / wordSize,
+        .vertexBase = vertexBase,
+        .indexSize = mesh.indexSize,
+        .attributeBase = bSplit ?
+            static_cast<uint32_t>(mesh.streamOffset[1] / wordSize) : vertexBase + vertexAttributeSize(fmt.position, 3) / wordSize,
+        .attributeStride = vertexFormatStreamStride(fmt, bSplit ? 1 : 0) / wordSize
+    };
+}
+
+void computeVertexFormatRanges(VertexFormat& fmt, const float* vertices, size_t vertexCount)
+{
+    const uint32_t numElements = vertexFormatFloatCount(fmt);
+
+    float lo[5] = {  FLT_MAX,  FLT_MAX,  FLT_MAX,  FLT_MAX,  FLT_MAX };
+    float hi[5] = { -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    const uint32_t numRanged = (fmt.texCoord != eVertexEncoding_None) ? 5 : 3;
+
+    for(size_t i = 0; i != vertexCount; i++)
+    {
+        const float* v = vertices + i * numElements;
+        for(uint32_t c = 0; c != numRanged; c++)
+        {
+            lo[c] = std::min(lo[c], v[c]);
+            hi[c] = std::max(hi[c], v[c]);
+        }
+    }
+
+    if(vertexCount == 0) { return; }
+
+    for(uint32_t c = 0; c != 3; c++)
+    {
+        fmt.positionOffset[c] = lo[c];
+        fmt.positionScale[c] = std::max(hi[c] - lo[c], FLT_MIN);
+    }
+    if(numRanged == 5)
+    {
+        for(uint32_t c = 0; c != 2; c++)
+        {
+            fmt.texCoordOffset[c] = lo[3 + c];
+            fmt.texCoordScale[c] = std::max(hi[3 + c] - lo[3 + c], FLT_MIN);
+        }
+    }
+}
+
+MeshBounds computeMeshBounds(const float* vertices, size_t stride, const uint32_t* indices, size_t indexCount)
+{
+    MeshBounds bounds = {};
+    bounds.coneCutoff = 1.0f;
+    if(indexCount == 0) { return bounds; }
+
+    // triangle corners as separate x/y/z arrays, so the reductions below run on full SIMD registers
+    std::vector<float> corners(indexCount * 3);
+    float* xs = corners.data();
+    float* ys = xs + indexCount;
+    float* zs = ys + indexCount;
+    for(size_t i = 0; i != indexCount; i++)
+    {
+        const float* v = vertices + size_t(indices[i]) * stride;
+        xs[i] = v[0];
+        ys[i] = v[1];
+        zs[i] = v[2];
+    }
+
+    // independent lanes keep the min/max and the distance reductions free of loop-carried dependencies
+    constexpr size_t kLanes = 8;
+    const size_t blockEnd = indexCount - indexCount % kLanes;
+
+    float lo[3][kLanes], hi[3][kLanes];
+    for(size_t l = 0; l != kLanes; l++)
+    {
+        lo[0][l] = lo[1][l] = lo[2][l] = FLT_MAX;
+        hi[0][l] = hi[1][l] = hi[2][l] = -FLT_MAX;
+    }
+    for(size_t i = 0; i != blockEnd; i += kLanes)
+    {
+        for(size_t l = 0; l != kLanes; l++)
+        {
+            lo[0][l] = std::min(lo[0][l], xs[i + l]);
+            lo[1][l] = std::min(lo[1][l], ys[i + l]);
+            lo[2][l] = std::min(lo[2][l], zs[i + l]);
+            hi[0][l] = std::max(hi[0][l], xs[i + l]);
+            hi[1][l] = std::max(hi[1][l], ys[i + l]);
+            hi[2][l] = std::max(hi[2][l], zs[i + l]);
+        }
+    }
+    for(size_t i = blockEnd; i != indexCount; i++)
+    {
+        lo[0][0] = std::min(lo[0][0], xs[i]);
+        lo[1][0] = std::min(lo[1][0], ys[i]);
+        lo[2][0] = std::min(lo[2][0], zs[i]);
+        hi[0][0] = std::max(hi[0][0], xs[i]);
+        hi[1][0] = std::max(hi[1][0], ys[i]);
+        hi[2][0] = std::max(hi[2][0], zs[i]);
+    }
+    for(uint32_t c = 0; c != 3; c++)
+    {
+        bounds.boxMin[c] = *std::min_element(lo[c], lo[c] + kLanes);
+        bounds.boxMax[c] = *std::max_element(hi[c], hi[c] + kLanes);
+        bounds.center[c] = 0.5f * (bounds.boxMin[c] + bounds.boxMax[c]);
+    }
+
+    const float cx = bounds.center[0], cy = bounds.center[1], cz = bounds.center[2];
+    float dist[kLanes] = {};
+    for(size_t i = 0; i != blockEnd; i += kLanes)
+    {
+        for(size_t l = 0; l != kLanes; l++)
+        {
+            const float dx = xs[i + l] - cx, dy = ys[i + l] - cy, dz = zs[i + l] - cz;
+            dist[l] = std::max(dist[l], dx * dx + dy * dy + dz * dz);
+        }
+    }
+    for(size_t i = blockEnd; i != indexCount; i++)
+    {
+        const float dx = xs[i] - cx, dy = ys[i] - cy, dz = zs[i] - cz;
+        dist[0] = std::max(dist[0], dx * dx + dy * dy + dz * dz);
+    }
+    bounds.radius = sqrtf(*std::max_element(dist, dist + kLanes));
+
+    // normal cone from the face normals, following meshopt_computeClusterBounds()
+    const size_t triangleCount = indexCount / 3;
+    std::vector<glm::vec3> normals(triangleCount);
+    glm::vec3 axis(0.0f);
+    for(size_t t = 0; t != triangleCount; t++)
+    {
+        const glm::vec3 p0(xs[t * 3 + 0], ys[t * 3 + 0], zs[t * 3 + 0]);
+        const glm::vec3 p1(xs[t * 3 + 1], ys[t * 3 + 1], zs[t * 3 + 1]);
+        const glm::vec3 p2(xs[t * 3 + 2], ys[t * 3 + 2], zs[t * 3 + 2]);
+        const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+        const float area = glm::length(n);
+        normals[t] = (area > 0.0f) ? n / area : glm::vec3(0.0f);
+        axis += normals[t];
+    }
+
+    const float axisLength = glm::length(axis);
+    if(axisLength <= 0.0f) { return bounds; }
+    axis /= axisLength;
+
+    float minDot = 1.0f;
+    for(const glm::vec3& n : normals)
+    {
+        if(n != glm::vec3(0.0f)) { minDot = std::min(minDot, glm::dot(n, axis)); }
+    }
+
+    bounds.coneAxis[0] = axis.x;
+    bounds.coneAxis[1] = axis.y;
+    bounds.coneAxis[2] = axis.z;
+
+    // wider than ~84 degrees: the cone test would almost never cull
+    if(minDot <= 0.1f) { return bounds; }
+
+    const glm::vec3 center(cx, cy, cz);
+    float maxT = 0.0f;
+    for(size_t t = 0; t != triangleCount; t++)
+    {
+        if(normals[t] == glm::vec3(0.0f)) { continue; }
+        const glm::vec3 p0(xs[t * 3], ys[t * 3], zs[t * 3]);
+        maxT = std::max(maxT, glm::dot(center - p0, normals[t]) / glm::dot(axis, normals[t]));
+    }
+
+    const glm::vec3 apex = center - axis * maxT;
+    bounds.coneApex[0] = apex.x;
+    bounds.coneApex[1] = apex.y;
+    bounds.coneApex[2] = apex.z;
+    bounds.coneCutoff = sqrtf(1.0f - minDot * minDot);
+    return bounds;
+}
+
+static inline void put16(uint8_t*& dst, uint16_t a, uint16_t b)
+{
+    const uint32_t word = uint32_t(a) | (uint32_t(b) << 16);
+    memcpy(dst, &word, sizeof(word));
+    dst += sizeof(word);
+}
+
+static inline uint16_t unorm16(float v, float offset, float scale)
+{
+    return static_cast<uint16_t>(meshopt_quantizeUnorm(std::clamp((v - offset) / scale, 0.0f, 1.0f), 16));
+}
+
+static inline uint16_t snorm16(float v)
+{
+    return static_cast<uint16_t>(static_cast<int16_t>(meshopt_quantizeSnorm(std::clamp(v, -1.0f, 1.0f), 16)));
+}
+
+static uint8_t* encodeAttribute(uint8_t* dst, uint32_t encoding, const float* v, uint32_t components, const float* offset, const float* scale)
+{
+    switch(encoding)
+    {
+        case eVertexEncoding_Float32:
+            memcpy(dst, v, components * sizeof(float));
+            return dst + components * sizeof(float);
+        case eVertexEncoding_Half:
+            for(uint32_t c = 0; c < components; c += 2)
+            {
+                put16(dst, meshopt_quantizeHalf(v[c]), (c + 1 < components) ? meshopt_quantizeHalf(v[c + 1]) : 0);
+            }
+            return dst;
+        case eVertexEncoding_Unorm16:
+            for(uint32_t c = 0; c < components; c += 2)
+            {
+                put16(dst, unorm16(v[c], offset[c], scale[c]), (c + 1 < components) ? unorm16(v[c + 1], offset[c + 1], scale[c + 1]) : 0);
+            }
+            return dst;
+        case eVertexEncoding_Octahedral16:
+        {
+            // project onto the octahedron, then fold the lower hemisphere over the diagonals
+            const float l1 = fabsf(v[0]) + fabsf(v[1]) + fabsf(v[2]);
+            float x = (l1 > 0.0f) ? v[0] / l1 : 0.0f;
+            float y = (l1 > 0.0f) ? v[1] / l1 : 0.0f;
+            if(v[2] < 0.0f)
+            {
+                const float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+                const float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+                x = fx;
+                y = fy;
+            }
+            put16(dst, snorm16(x), snorm16(y));
+            return dst;
+        }
+        default:
+            return dst;
+    }
+}
+
+void encodeVertices(const VertexFormat& fmt, const float* vertices, size_t vertexCount, uint8_t* dst)
+{
+    const uint32_t numElements = vertexFormatFloatCount(fmt);
+    // attributes go after all positions when they have a stream of their own
+    uint8_t* positionDst = dst;
+    uint8_t* attributeDst = (vertexFormatStreamCount(fmt) == 2) ? dst + vertexCount * vertexFormatStreamStride(fmt, 0) : nullptr;
+
+    for(size_t i = 0; i != vertexCount; i++)
+    {
+        const float* v = vertices + i * numElements;
+        positionDst = encodeAttribute(positionDst, fmt.position, v, 3, fmt.positionOffset, fmt.positionScale);
+        dst = attributeDst ? attributeDst : positionDst;
+        v += 3;
+        if(fmt.texCoord != eVertexEncoding_None)
+        {
+            dst = encodeAttribute(dst, fmt.texCoord, v, 2, fmt.texCoordOffset, fmt.texCoordScale);
+            v += 2;
+        }
+        if(fmt.normal != eVertexEncoding_None)
+        {
+            dst = encodeAttribute(dst, fmt.normal, v, 3, nullptr, nullptr);
+        }
+
+        if(attributeDst) { attributeDst = dst; }
+        else { positionDst = dst; }
+    }
+}
+
+static float halfToFloat(uint16_t h)
+{
+    const uint32_t sign = uint32_t(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1F;
+    const uint32_t mantissa = h & 0x3FF;
+
+    float result;
+    if(exponent == 0)
+    {
+        result = ldexpf(float(mantissa), -24);
+    }
+    else if(exponent == 31)
+    {
+        result = mantissa ? NAN : INFINITY;
+    }
+    else
+    {
+        result = ldexpf(float(mantissa | 0x400), int(exponent) - 25);
+    }
+    return sign ? -result : result;
+}
+
+glm::vec3 decodeVertexPosition(const VertexFormat& fmt, const uint8_t* vertex)
+{
+    glm::vec3 p(0.0f);
+    if(fmt.position == eVertexEncoding_Float32)
+    {
+        memcpy(&p, vertex, sizeof(float) * 3);
+        return p;
+    }
+
+    uint16_t q[4];
+    memcpy(q, vertex, sizeof(q));
+    for(int c = 0; c != 3; c++)
+    {
+        p[c] = (fmt.position == eVertexEncoding_Half) ?
+            halfToFloat(q[c]) :
+            fmt.positionOffset[c] + (float(q[c]) / 65535.0f) * fmt.positionScale[c];
+    }
+    return p;
+}
+
+/* Appends one (size, encoded bytes) pair of a compressed block */
+static void appendEncodedBlob(std::vector<uint8_t>& result, const std::vector<uint8_t>& encoded)
+{
+    const uint32_t size = static_cast<uint32_t>(encoded.size());
+    const uint8_t* sizeBytes = reinterpret_cast<const uint8_t*>(&size);
+    result.insert(result.end(), sizeBytes, sizeBytes + sizeof(size));
+    result.insert(result.end(), encoded.begin(), encoded.end());
+}
+
+/* Appends the (size, encoded bytes) pairs of all LODs of 'mesh'; lodOffset is relative to 'indexData' */
+static void encodeMeshIndices(const Mesh& mesh, const uint8_t* indexData, std::vector<uint8_t>& result)
+{
+    std::vector<uint32_t> indices;
+    std::vector<uint8_t> encoded;
+
+    const size_t vertexCount = std::max<size_t>(mesh.vertexCount, 1);
+    for(uint32_t l = 0; l != mesh.lodCount; l++)
+    {
+        const uint8_t* src = indexData + mesh.lodOffset[l];
+        indices.resize(mesh.getLODSize(l) / mesh.indexSize);
+        for(size_t i = 0; i != indices.size(); i++)
+        {
+            if(mesh.indexSize == sizeof(uint16_t))
+            {
+                uint16_t idx;
+                memcpy(&idx, src + i * sizeof(uint16_t), sizeof(idx));
+                indices[i] = idx;
+            }
+            else
+            {
+                memcpy(&indices[i], src + i * sizeof(uint32_t), sizeof(uint32_t));
+            }
+        }
+
+        encoded.resize(meshopt_encodeIndexBufferBound(indices.size(), vertexCount));
+        encoded.resize(meshopt_encodeIndexBuffer(encoded.data(), encoded.size(), indices.data(), indices.size()));
+        appendEncodedBlob(result, encoded);
+    }
+}
+
+/* Appends the (size, encoded bytes) pairs of all vertex streams of 'mesh'; streamOffset is relative to 'vertexData' */
+static void encodeMeshVertices(const Mesh& mesh, const uint8_t* vertexData, std::vector<uint8_t>& result)
+{
+    std::vector<uint8_t> encoded;
+    for(uint32_t s = 0; s != mesh.streamCount; s++)
+    {
+        // stream strides are whole words (vertex pulling reads uints), as the codec requires
+        encoded.resize(meshopt_encodeVertexBufferBound(mesh.vertexCount, mesh.streamElementSize[s]));
+        encoded.resize(meshopt_encodeVertexBuffer(encoded.data(), encoded.size(), vertexData + mesh.streamOffset[s], mesh.vertexCount, mesh.streamElementSize[s]));
+        appendEncodedBlob(result, encoded);
+    }
+}
+
+/* The block that follows has to stay 4-byte aligned */
+static void padEncodedBlock(std::vector<uint8_t>& result)
+{
+    result.resize((result.size() + 3) & ~size_t(3));
+}
+
+static std::vector<uint8_t> encodeIndexData(const MeshData& m)
+{
+    std::vector<uint8_t> result;
+    for(const Mesh& mesh : m.meshes)
+    {
+        encodeMeshIndices(mesh, m.indexData.data(), result);
+    }
+    padEncodedBlock(result);
+    return result;
+}
+
+static std::vector<uint8_t> encodeVertexData(const MeshData& m)
+{
+    std::vector<uint8_t> result;
+    for(const Mesh& mesh : m.meshes)
+    {
+        encodeMeshVertices(mesh, m.vertexData.data(), result);
+    }
+    padEncodedBlock(result);
+    return result;
+}
+
+bool saveMeshData(FILE* f, const MeshData& m, uint32_t indexCodec, uint32_t vertexCodec, uint64_t sourceKey)
+{
+    std::vector<uint8_t> encodedIndexData;
+    if(indexCodec == eIndexCodec_Meshopt)
+    {
+        encodedIndexData = encodeIndexData(m);
+    }
+    const std::span<const uint8_t> storedIndexData = (indexCodec == eIndexCodec_Meshopt) ?
+        std::span<const uint8_t>(encodedIndexData) : std::span<const uint8_t>(m.indexData);
+
+    std::vector<uint8_t> encodedVertexData;
+    if(vertexCodec == eVertexCodec_Meshopt)
+    {
+        encodedVertexData = encodeVertexData(m);
+    }
+    const std::span<const uint8_t> storedVertexData = (vertexCodec == eVertexCodec_Meshopt) ?
+        std::span<const uint8_t>(encodedVertexData) : std::span<const uint8_t>(m.vertexData);
+
+    const MeshFileHeader header =
+    {
+        .magicValue = kMeshFileMagic,
+        .version = kMeshFileVersion,
+        .meshCount = static_cast<uint32_t>(m.meshes.size()),
+        .dataBlockStartOffset = static_cast<uint32_t>(sizeof(MeshFileHeader) + m.meshes.size() * sizeof(Mesh)),
+        .indexDataSize = m.indexData.size(),
+        .vertexDataSize = m.vertexData.size(),
+        .checksum = meshDataChecksum(m.meshes, storedIndexData, storedVertexData, m.meshlets, m.meshletVertices, m.meshletTriangles, m.bounds),
+        .indexCodec = indexCodec,
+        .vertexCodec = vertexCodec,
+        .storedIndexDataSize = storedIndexData.size(),
+        .meshletCount = static_cast<uint32_t>(m.meshlets.size()),
+        .meshletVertexCount = static_cast<uint32_t>(m.meshletVertices.size()),
+        .meshletTriangleDataSize = m.meshletTriangles.size(),
+        .sourceKey = sourceKey,
+        .boundsCount = static_cast<uint32_t>(m.bounds.size()),
+        .reserved = 0,
+        .storedVertexDataSize = storedVertexData.size()
+    };
+
+    if( fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fwrite(m.meshes.data(), sizeof(Mesh), m.meshes.size(), f) != m.meshes.size() ||
+        fwrite(storedIndexData.data(), 1, storedIndexData.size(), f) != storedIndexData.size() ||
+        fwrite(storedVertexData.data(), 1, storedVertexData.size(), f) != storedVertexData.size() ||
+        fwrite(m.meshlets.data(), sizeof(Meshlet), m.meshlets.size(), f) != m.meshlets.size() ||
+        fwrite(m.meshletVertices.data(), sizeof(uint32_t), m.meshletVertices.size(), f) != m.meshletVertices.size() ||
+        fwrite(m.meshletTriangles.data(), 1, m.meshletTriangles.size(), f) != m.meshletTriangles.size() ||
+        fwrite(m.bounds.data(), sizeof(MeshBounds), m.bounds.size(), f) != m.bounds.size())
+    {
+        printf("I/O error while writing mesh data\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool saveMeshData(const char* fileName, const MeshData& m, uint32_t indexCodec, uint32_t vertexCodec, uint64_t sourceKey)
+{
+    FILE* f = fopen(fileName, "wb");
+    if(!f)
+    {
+        printf("I/O error. Cannot open '%s' for writing\n", fileName);
+        return false;
+    }
+
+    const bool result = saveMeshData(f, m, indexCodec, vertexCodec, sourceKey);
+    return (fclose(f) == 0) && result;
+}
+
+MeshFileWriter::~MeshFileWriter()
+{
+    abandon();
+}
+
+void MeshFileWriter::abandon()
+{
+    if(m_file)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+        remove(m_fileName.c_str());
+    }
+    for(Spool& spool : m_spools)
+    {
+        if(spool.file)
+        {
+            fclose(spool.file);
+            spool.file = nullptr;
+            remove(spool.fileName.c_str());
+        }
+    }
+}
+
+bool MeshFileWriter::open(const char* fileName, uint32_t meshCount, uint32_t indexCodec, uint32_t vertexCodec, uint64_t sourceKey)
+{
+    abandon();
+
+    m_fileName = fileName;
+    m_meshCount = meshCount;
+    m_indexCodec = indexCodec;
+    m_vertexCodec = vertexCodec;
+    m_sourceKey = sourceKey;
+    m_meshes.clear();
+    m_meshes.reserve(meshCount);
+    m_indexDataSize = 0;
+    m_vertexDataSize = 0;
+    m_index = Spool();
+
+    static const char* kSpoolSuffixes[eSpool_Count] = { ".vertices", ".meshlets", ".meshletVertices", ".meshletTriangles", ".bounds" };
+
+    m_file = fopen(fileName, "wb");
+    m_index.file = m_file;
+    bool result = m_file != nullptr;
+    for(uint32_t i = 0; i != eSpool_Count && result; i++)
+    {
+        m_spools[i] = Spool();
+        m_spools[i].fileName = m_fileName + kSpoolSuffixes[i];
+        m_spools[i].file = fopen(m_spools[i].fileName.c_str(), "w+b");
+        result = m_spools[i].file != nullptr;
+    }
+
+    if(!result)
+    {
+        printf("I/O error. Cannot open '%s' for writing\n", fileName);
+        abandon();
+        return false;
+    }
+
+    // header and Mesh table are backpatched by close()
+    const size_t tableSize = sizeof(MeshFileHeader) + size_t(meshCount) * sizeof(Mesh);
+    if(fseek(m_file, static_cast<long>(tableSize), SEEK_SET) != 0)
+    {
+        printf("I/O error while writing mesh data\n");
+        abandon();
+        return false;
+    }
+
+    return true;
+}
+
+bool MeshFileWriter::write(Spool& spool, const void* data, size_t size)
+{
+    if(!size) { return true; }
+
+    spool.hash.update(data, size);
+    spool.size += size;
+    return fwrite(data, 1, size, spool.file) == size;
+}
+
+bool MeshFileWriter::addMesh(const Mesh& mesh, std::span<const MeshBounds> bounds, std::span<const uint8_t> indexData, std::span<const uint8_t> vertexData,
+    std::span<const Meshlet> meshlets, std::span<const uint32_t> meshletVertices, std::span<const uint8_t> meshletTriangles)
+{
+    if(!m_file || m_meshes.size() == m_meshCount)
+    {
+        printf("MeshFileWriter: more meshes than announced in open()\n");
+        return false;
+    }
+
+    bool result;
+    if(m_indexCodec == eIndexCodec_Meshopt)
+    {
+        std::vector<uint8_t> encoded;
+        encodeMeshIndices(mesh, indexData.data(), encoded);
+        result = write(m_index, encoded.data(), encoded.size());
+    }
+    else
+    {
+        result = write(m_index, indexData.data(), indexData.size());
+    }
+
+    Mesh rebased = mesh;
+    for(uint32_t l = 0; l <= rebased.lodCount; l++)
+    {
+        rebased.lodOffset[l] += static_cast<uint32_t>(m_indexDataSize);
+    }
+    for(uint32_t s = 0; s != rebased.streamCount; s++)
+    {
+        rebased.streamOffset[s] += m_vertexDataSize;
+    }
+    rebased.meshletOffset = static_cast<uint32_t>(m_spools[eSpool_Meshlets].size / sizeof(Meshlet));
+    rebased.boundsOffset = static_cast<uint32_t>(m_spools[eSpool_Bounds].size / sizeof(MeshBounds));
+    m_meshes.push_back(rebased);
+    m_indexDataSize += indexData.size();
+    m_vertexDataSize += vertexData.size();
+
+    const uint32_t meshletVertexBase = static_cast<uint32_t>(m_spools[eSpool_MeshletVertices].size / sizeof(uint32_t));
+    const uint32_t meshletTriangleBase = static_cast<uint32_t>(m_spools[eSpool_MeshletTriangles].size);
+    for(const Meshlet& meshlet : meshlets)
+    {
+        Meshlet m = meshlet;
+        m.vertexOffset += meshletVertexBase;
+        m.triangleOffset += meshletTriangleBase;
+        result = result && write(m_spools[eSpool_Meshlets], &m, sizeof(m));
+    }
+
+    if(m_vertexCodec == eVertexCodec_Meshopt)
+    {
+        std::vector<uint8_t> encoded;
+        encodeMeshVertices(mesh, vertexData.data(), encoded);
+        result = result && write(m_spools[eSpool_Vertices], encoded.data(), encoded.size());
+    }
+    else
+    {
+        result = result && write(m_spools[eSpool_Vertices], vertexData.data(), vertexData.size_bytes());
+    }
+
+    result = result &&
+        write(m_spools[eSpool_MeshletVertices], meshletVertices.data(), meshletVertices.size_bytes()) &&
+        write(m_spools[eSpool_MeshletTriangles], meshletTriangles.data(), meshletTriangles.size_bytes()) &&
+        write(m_spools[eSpool_Bounds], bounds.data(), bounds.size_bytes());
+
+    if(!result)
+    {
+        printf("I/O error while writing mesh data\n");
+    }
+    return result;
+}
+
+bool MeshFileWriter::close()
+{
+    if(!m_file) { return false; }
+
+    if(m_meshes.size() != m_meshCount)
+    {
+        printf("MeshFileWriter: %zu meshes added, %u announced\n", m_meshes.size(), m_meshCount);
+        abandon();
+        return false;
+    }
+
+    bool result = true;
+
+    // the blocks that follow have to stay 4-byte aligned, see padEncodedBlock()
+    const uint8_t zeros[4] = {};
+    if(m_indexCodec == eIndexCodec_Meshopt)
+    {
+        result = write(m_index, zeros, (4 - (m_index.size & 3)) & 3);
+    }
+    if(m_vertexCodec == eVertexCodec_Meshopt)
+    {
+        Spool& vertices = m_spools[eSpool_Vertices];
+        result = result && write(vertices, zeros, (4 - (vertices.size & 3)) & 3);
+    }
+
+    std::vector<uint8_t> buffer(1 << 20);
+    for(Spool& spool : m_spools)
+    {
+        result = result && fflush(spool.file) == 0 && fseek(spool.file, 0, SEEK_SET) == 0;
+        for(uint64_t left = spool.size; result && left; )
+        {
+            const size_t chunk = static_cast<size_t>(std::min<uint64_t>(left, buffer.size()));
+            result = fread(buffer.data(), 1, chunk, spool.file) == chunk && fwrite(buffer.data(), 1, chunk, m_file) == chunk;
+            left -= chunk;
+        }
+    }
+
+    uint64_t checksum = hashBytes(m_meshes.data(), m_meshes.size() * sizeof(Mesh));
+    checksum = hashCombine(checksum, m_index.hash.digest());
+    for(const Spool& spool : m_spools)
+    {
+        checksum = hashCombine(checksum, spool.hash.digest());
+    }
+
+    const MeshFileHeader header =
+    {
+        .magicValue = kMeshFileMagic,
+        .version = kMeshFileVersion,
+        .meshCount = m_meshCount,
+        .dataBlockStartOffset = static_cast<uint32_t>(sizeof(MeshFileHeader) + m_meshes.size() * sizeof(Mesh)),
+        .indexDataSize = m_indexDataSize,
+        .vertexDataSize = m_vertexDataSize,
+        .checksum = checksum,
+        .indexCodec = m_indexCodec,
+        .vertexCodec = m_vertexCodec,
+        .storedIndexDataSize = m_index.size,
+        .meshletCount = static_cast<uint32_t>(m_spools[eSpool_Meshlets].size / sizeof(Meshlet)),
+        .meshletVertexCount = static_cast<uint32_t>(m_spools[eSpool_MeshletVertices].size / sizeof(uint32_t)),
+        .meshletTriangleDataSize = m_spools[eSpool_MeshletTriangles].size,
+        .sourceKey = m_sourceKey,
+        .boundsCount = static_cast<uint32_t>(m_spools[eSpool_Bounds].size / sizeof(MeshBounds)),
+        .reserved = 0,
+        .storedVertexDataSize = m_spools[eSpool_Vertices].size
+    };
+
+    result = result &&
+        fseek(m_file, 0, SEEK_SET) == 0 &&
+        fwrite(&header, sizeof(header), 1, m_file) == 1 &&
+        fwrite(m_meshes.data(), sizeof(Mesh), m_meshes.size(), m_file) == m_meshes.size();
+
+    for(Spool& spool : m_spools)
+    {
+        fclose(spool.file);
+        spool.file = nullptr;
+        remove(spool.fileName.c_str());
+    }
+
+    result = (fclose(m_file) == 0) && result;
+    m_file = nullptr;
+    m_meshes = std::vector<Mesh>();
+
+    if(!result)
+    {
+        printf("I/O error while writing mesh data\n");
+        remove(m_fileName.c_str());
+    }
+    return result;
+}
+
+void sortInstances(std::span<InstanceData> instances)
+{
+    // stable, so instances of one mesh keep their scene order
+    std::stable_sort(instances.begin(), instances.end(), [](const InstanceData& a, const InstanceData& b)
+    {
+        return (a.materialIndex != b.materialIndex) ? (a.materialIndex < b.materialIndex) : (a.meshIndex < b.meshIndex);
+    });
+}
+
+std::vector<DrawBatch> buildDrawBatches(std::span<const InstanceData> instances)
+{
+    std::vector<DrawBatch> batches;
+    for(uint32_t i = 0; i != instances.size(); i++)
+    {
+        if(batches.empty() || batches.back().materialIndex != instances[i].materialIndex)
+        {
+            batches.push_back(DrawBatch{ .materialIndex = instances[i].materialIndex, .firstInstance = i, .instanceCount = 0 });
+        }
+        batches.back().instanceCount++;
+    }
+    return batches;
+}
+
+bool saveInstanceData(const char* fileName, std::span<const InstanceData> instances)
+{
+    FILE* f = fopen(fileName, "wb");
+    if(!f)
+    {
+        printf("I/O error. Cannot open '%s' for writing\n", fileName);
+        return false;
+    }
+
+    const bool result = fwrite(instances.data(), sizeof(InstanceData), instances.size(), f) == instances.size();
+    return (fclose(f) == 0) && result;
+}
+
+bool readMeshFileHeader(const char* fileName, MeshFileHeader& header)
+{
+    FILE* f = fopen(fileName, "rb");
+    if(!f) { return false; }
+
+    const bool result = fread(&header, sizeof(header), 1, f) == 1;
+    fclose(f);
+
+    return result && header.magicValue == kMeshFileMagic && header.version == kMeshFileVersion;
+}
+
+/**
+ * Finds where the (size, encoded bytes) pairs of every mesh start in a compressed block, so meshes can be decoded
+ * independently. The index block has one pair per LOD, the vertex block one per stream.
+ */
+static bool findEncodedMeshes(std::span<const Mesh> meshes, std::span<const uint8_t> stored, bool bVertexBlock, std::vector<size_t>& starts)
+{
+    starts.resize(meshes.size());
+
+    size_t pos = 0;
+    for(size_t i = 0; i != meshes.size(); i++)
+    {
+        starts[i] = pos;
+
+        const uint32_t pairCount = bVertexBlock ? meshes[i].streamCount : meshes[i].lodCount;
+        if(pairCount > (bVertexBlock ? kMaxStreams : kMaxLODs)) { return false; }
+
+        for(uint32_t p = 0; p != pairCount; p++)
+        {
+            uint32_t size = 0;
+            if(stored.size() - pos < sizeof(size)) { return false; }
+            memcpy(&size, stored.data() + pos, sizeof(size));
+            pos += sizeof(size);
+            if(stored.size() - pos < size) { return false; }
+            pos += size;
+        }
+    }
+    return true;
+}
+
+/* Returns the encoded bytes of the pair at 'src' and advances past it; bounds were checked by findEncodedMeshes() */
+static std::span<const uint8_t> nextEncodedBlob(const uint8_t*& src)
+{
+    uint32_t size = 0;
+    memcpy(&size, src, sizeof(size));
+    const std::span<const uint8_t> blob = { src + sizeof(size), size };
+    src += sizeof(size) + size;
+    return blob;
+}
+
+static bool decodeMeshIndices(const Mesh& mesh, const uint8_t* src, std::vector<uint8_t>& decoded)
+{
+    if((mesh.indexSize != sizeof(uint16_t) && mesh.indexSize != sizeof(uint32_t)) || mesh.lodOffset[mesh.lodCount] > decoded.size())
+    {
+        return false;
+    }
+
+    for(uint32_t l = 0; l != mesh.lodCount; l++)
+    {
+        // the codec only takes whole triangles
+        if(mesh.lodOffset[l] > mesh.lodOffset[l + 1] || (mesh.getLODSize(l) % (3 * mesh.indexSize)) != 0) { return false; }
+
+        const std::span<const uint8_t> blob = nextEncodedBlob(src);
+        if(meshopt_decodeIndexBuffer(decoded.data() + mesh.lodOffset[l], mesh.getLODSize(l) / mesh.indexSize, mesh.indexSize, blob.data(), blob.size()) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool decodeMeshVertices(const Mesh& mesh, const uint8_t* src, std::vector<uint8_t>& decoded)
+{
+    for(uint32_t s = 0; s != mesh.streamCount; s++)
+    {
+        const uint32_t stride = mesh.streamElementSize[s];
+        if(stride == 0 || stride > 256 || (stride % sizeof(uint32_t)) != 0 || mesh.streamOffset[s] > decoded.size() ||
+           uint64_t(mesh.vertexCount) * stride > decoded.size() - mesh.streamOffset[s])
+        {
+            return false;
+        }
+
+        const std::span<const uint8_t> blob = nextEncodedBlob(src);
+        if(meshopt_decodeVertexBuffer(decoded.data() + mesh.streamOffset[s], mesh.vertexCount, stride, blob.data(), blob.size()) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* True if every LOD and vertex stream of 'mesh' lies inside the (decoded) index and vertex blocks */
+static bool isMeshInBounds(const Mesh& mesh, const MeshFileHeader& header)
+{
+    if(mesh.lodCount == 0 || mesh.lodCount > kMaxLODs || mesh.streamCount > kMaxStreams) { return false; }
+    if(mesh.indexSize != sizeof(uint16_t) && mesh.indexSize != sizeof(uint32_t)) { return false; }
+    if((mesh.lodOffset[0] % mesh.indexSize) != 0 || mesh.lodOffset[mesh.lodCount] > header.indexDataSize) { return false; }
+
+    for(uint32_t l = 0; l != mesh.lodCount; l++)
+    {
+        if(mesh.lodOffset[l] > mesh.lodOffset[l + 1] || (mesh.getLODSize(l) % (3 * mesh.indexSize)) != 0) { return false; }
+    }
+    for(uint32_t s = 0; s != mesh.streamCount; s++)
+    {
+        const uint32_t stride = mesh.streamElementSize[s];
+        if(stride == 0 || mesh.streamOffset[s] > header.vertexDataSize ||
+           uint64_t(mesh.vertexCount) * stride > header.vertexDataSize - mesh.streamOffset[s])
+        {
+            return false;
+        }
+    }
+    return uint64_t(mesh.meshletOffset) + mesh.meshletCount <= header.meshletCount;
+}
+
+bool mapMeshFile(const char* fileName, MeshFileView& view, bool verifyChecksum, ThreadPool* pool)
+{
+    view = MeshFileView();
+
+    size_t fileSize = 0;
+    void* ptr = mapFileReadOnly(fileName, &fileSize);
+    if(!ptr)
+    {
+        printf("I/O error. Cannot map '%s'\n", fileName);
+        return false;
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(ptr);
+
+    auto fail = [&](const char* reason)
+    {
+        printf("Invalid mesh file '%s': %s\n", fileName, reason);
+        unmapFile(ptr, fileSize);
+        return false;
+    };
+
+    if(fileSize < sizeof(MeshFileHeader)) { return fail("truncated header"); }
+
+    const MeshFileHeader header = *reinterpret_cast<const MeshFileHeader*>(bytes);
+
+    if(header.magicValue != kMeshFileMagic) { return fail("bad magic value"); }
+    if(header.version != kMeshFileVersion) { return fail("unsupported version, reconvert the source asset"); }
+
+    const uint64_t meshTableEnd = sizeof(MeshFileHeader) + uint64_t(header.meshCount) * sizeof(Mesh);
+    if(header.dataBlockStartOffset < meshTableEnd || (header.dataBlockStartOffset % sizeof(uint32_t)) != 0)
+    {
+        return fail("bad data block offset");
+    }
+    if(header.indexCodec != eIndexCodec_None && header.indexCodec != eIndexCodec_Meshopt)
+    {
+        return fail("unknown index codec");
+    }
+    if(header.vertexCodec != eVertexCodec_None && header.vertexCodec != eVertexCodec_Meshopt)
+    {
+        return fail("unknown vertex codec");
+    }
+    if(header.indexCodec == eIndexCodec_None && header.storedIndexDataSize != header.indexDataSize)
+    {
+        return fail("bad index block size");
+    }
+    if(header.vertexCodec == eVertexCodec_None && header.storedVertexDataSize != header.vertexDataSize)
+    {
+        return fail("bad vertex block size");
+    }
+    if((header.storedIndexDataSize % sizeof(uint32_t)) != 0 || (header.storedVertexDataSize % sizeof(uint32_t)) != 0 ||
+       (header.vertexDataSize % sizeof(uint32_t)) != 0 || (header.meshletTriangleDataSize % sizeof(uint32_t)) != 0)
+    {
+        return fail("misaligned data blocks");
+    }
+    const uint64_t meshletDataSize =
+        uint64_t(header.meshletCount) * sizeof(Meshlet) + uint64_t(header.meshletVertexCount) * sizeof(uint32_t) + header.meshletTriangleDataSize;
+    const uint64_t boundsDataSize = uint64_t(header.boundsCount) * sizeof(MeshBounds);
+    if(header.dataBlockStartOffset + header.storedIndexDataSize + header.storedVertexDataSize + meshletDataSize + boundsDataSize > fileSize)
+    {
+        return fail("truncated data blocks");
+    }
+
+    const uint8_t* indexBlock = bytes + header.dataBlockStartOffset;
+    const uint8_t* vertexBlock = indexBlock + header.storedIndexDataSize;
+    const uint8_t* meshletBlock = vertexBlock + header.storedVertexDataSize;
+    const uint8_t* meshletVertexBlock = meshletBlock + uint64_t(header.meshletCount) * sizeof(Meshlet);
+    const uint8_t* meshletTriangleBlock = meshletVertexBlock + uint64_t(header.meshletVertexCount) * sizeof(uint32_t);
+    const uint8_t* boundsBlock = meshletTriangleBlock + header.meshletTriangleDataSize;
+    const std::span<const uint8_t> storedIndexData = { indexBlock, header.storedIndexDataSize };
+    const std::span<const uint8_t> storedVertexData = { vertexBlock, header.storedVertexDataSize };
+
+    view.header = header;
+    view.meshes = { reinterpret_cast<const Mesh*>(bytes + sizeof(MeshFileHeader)), header.meshCount };
+    view.indexData = storedIndexData;
+    view.vertexData = storedVertexData;
+    view.meshlets = { reinterpret_cast<const Meshlet*>(meshletBlock), header.meshletCount };
+    view.meshletVertices = { reinterpret_cast<const uint32_t*>(meshletVertexBlock), header.meshletVertexCount };
+    view.meshletTriangles = { meshletTriangleBlock, header.meshletTriangleDataSize };
+    view.bounds = { reinterpret_cast<const MeshBounds*>(boundsBlock), header.boundsCount };
+    view.mappedPtr = ptr;
+    view.mappedSize = fileSize;
+
+    if(verifyChecksum && meshDataChecksum(view.meshes, storedIndexData, storedVertexData, view.meshlets, view.meshletVertices, view.meshletTriangles, view.bounds) != header.checksum)
+    {
+        view = MeshFileView();
+        return fail("checksum mismatch");
+    }
+
+    // renderers index the blocks with these offsets, so a corrupt table must not get past here
+    for(const Mesh& mesh : view.meshes)
+    {
+        if(!isMeshInBounds(mesh, header))
+        {
+            view = MeshFileView();
+            return fail("mesh outside of the data blocks");
+        }
+    }
+
+    const bool bDecodeIndices = header.indexCodec == eIndexCodec_Meshopt;
+    const bool bDecodeVertices = header.vertexCodec == eVertexCodec_Meshopt;
+    if(!bDecodeIndices && !bDecodeVertices) { return true; }
+
+    // the pairs are located serially, then every mesh is decoded on its own
+    std::vector<size_t> indexStarts, vertexStarts;
+    if((bDecodeIndices && !findEncodedMeshes(view.meshes, storedIndexData, false, indexStarts)) ||
+       (bDecodeVertices && !findEncodedMeshes(view.meshes, storedVertexData, true, vertexStarts)))
+    {
+        view = MeshFileView();
+        return fail("corrupt compressed data");
+    }
+
+    view.decodedIndexData.resize(bDecodeIndices ? header.indexDataSize : 0);
+    view.decodedVertexData.resize(bDecodeVertices ? header.vertexDataSize : 0);
+
+    std::atomic<bool> bCorrupt = false;
+    auto decodeMesh = [&](size_t i)
+    {
+        const Mesh& mesh = view.meshes[i];
+        if((bDecodeIndices && !decodeMeshIndices(mesh, storedIndexData.data() + indexStarts[i], view.decodedIndexData)) ||
+           (bDecodeVertices && !decodeMeshVertices(mesh, storedVertexData.data() + vertexStarts[i], view.decodedVertexData)))
+        {
+            bCorrupt = true;
+        }
+    };
+
+    if(pool)
+    {
+        pool->parallelFor(view.meshes.size(), decodeMesh);
+    }
+    else
+    {
+        for(size_t i = 0; i != view.meshes.size(); i++) { decodeMesh(i); }
+    }
+
+    if(bCorrupt)
+    {
+        view = MeshFileView();
+        return fail("corrupt compressed data");
+    }
+
+    if(bDecodeIndices) { view.indexData = view.decodedIndexData; }
+    if(bDecodeVertices) { view.vertexData = view.decodedVertexData; }
+
+    return true;
+}
+
+void unmapMeshFile(MeshFileView& view)
+{
+    if(view.mappedPtr)
+    {
+        unmapFile(view.mappedPtr, view.mappedSize);
+    }
+    view = MeshFileView();
+}
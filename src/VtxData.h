@@ -1,16 +1,155 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
+#include <span>
+#include <string>
+#include <vector>
 
 #include <glm/glm.hpp>
 
+#include "UtilsHash.h"
 #include "UtilsMath.h"
 
+class ThreadPool;
+
 // Max number of LODs
 constexpr const uint32_t kMaxLODs       = 8;
 // Max number of vertex streams; vertex streams is a term for vertex attributes in an homogenous array
 constexpr const uint32_t kMaxStreams    = 8;
 
+// Value at the top of every mesh file
+constexpr const uint32_t kMeshFileMagic   = 0x12345678;
+// Bumped whenever the layout of MeshFileHeader, Mesh or the data blocks changes; old files have to be reconverted
+constexpr const uint32_t kMeshFileVersion = 11;
+
+/* Encoding of the index block inside a mesh file */
+enum eIndexCodec : uint32_t
+{
+    // indices are stored as they are uploaded
+    eIndexCodec_None = 0,
+    // every LOD is compressed with meshopt_encodeIndexBuffer and decoded by mapMeshFile()
+    eIndexCodec_Meshopt
+};
+
+/* Encoding of the vertex block inside a mesh file */
+enum eVertexCodec : uint32_t
+{
+    // vertices are stored as they are uploaded
+    eVertexCodec_None = 0,
+    // every vertex stream of every mesh is compressed with meshopt_encodeVertexBuffer and decoded by mapMeshFile()
+    eVertexCodec_Meshopt
+};
+
+/**
+ * A cluster of up to kMaxMeshletVertices vertices and kMaxMeshletTriangles triangles of a mesh LOD 0.
+ * Laid out as four vec4s (std430) so a culling compute shader can read the table directly.
+ */
+struct Meshlet
+{
+    /* First entry in the meshlet vertex table, entries are vertex indices local to the mesh */
+    uint32_t vertexOffset;
+    /* First byte in the meshlet triangle table, 3 bytes per triangle indexing the meshlet vertices */
+    uint32_t triangleOffset;
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+
+    /* Bounding sphere in object space */
+    float center[3];
+    float radius;
+
+    /* Normal cone: the meshlet is backfacing when dot(normalize(apex - cameraPos), axis) >= cutoff */
+    float coneAxis[3];
+    float coneCutoff;
+
+    float coneApex[3];
+    float padding;
+};
+
+/**
+ * Object space bounds of one mesh LOD, computed by the converter so culling never has to read vertex data.
+ * Laid out as five vec4s (std430).
+ */
+struct MeshBounds
+{
+    /* Bounding sphere, centered on the box */
+    float center[3];
+    float radius;
+
+    float boxMin[3];
+    float padding0;
+    float boxMax[3];
+    float padding1;
+
+    /* Normal cone with the same convention as Meshlet; coneCutoff is 1 when the LOD can never be backface culled */
+    float coneAxis[3];
+    float coneCutoff;
+
+    float coneApex[3];
+    float padding2;
+};
+
+constexpr const uint32_t kMaxMeshletVertices  = 64;
+constexpr const uint32_t kMaxMeshletTriangles = 124;
+
+/* Storage of a single vertex attribute inside a vertex stream */
+enum eVertexEncoding : uint32_t
+{
+    // attribute is not stored
+    eVertexEncoding_None = 0,
+    // 32-bit float per component
+    eVertexEncoding_Float32,
+    // 16-bit float per component
+    eVertexEncoding_Half,
+    // 16-bit normalized per component, relative to the offset/scale of the VertexFormat
+    eVertexEncoding_Unorm16,
+    // two 16-bit snorm components of an octahedral mapped unit vector (normals only)
+    eVertexEncoding_Octahedral16
+};
+
+/* Distribution of the vertex attributes over the vertex streams of a mesh */
+enum eVertexLayout : uint32_t
+{
+    // one stream with position, texCoord and normal of a vertex next to each other
+    eVertexLayout_Interleaved = 0,
+    // stream 0 holds positions only, stream 1 texCoord and normal; depth-only passes read just stream 0
+    eVertexLayout_Split
+};
+
+/**
+ * Describes how the attributes of a vertex are encoded and laid out.
+ * Attributes are ordered as position, texCoord, normal; every attribute starts at a 4-byte boundary
+ * so vertex pulling shaders can read the streams as an array of uint.
+ */
+struct VertexFormat
+{
+    uint32_t position = eVertexEncoding_Float32;
+    uint32_t texCoord = eVertexEncoding_None;
+    uint32_t normal = eVertexEncoding_None;
+    uint32_t layout = eVertexLayout_Interleaved;
+
+    /* Dequantization parameters: value = offset + encoded * scale */
+    float positionOffset[3] = { 0.0f, 0.0f, 0.0f };
+    float positionScale[3] = { 1.0f, 1.0f, 1.0f };
+    float texCoordOffset[2] = { 0.0f, 0.0f };
+    float texCoordScale[2] = { 1.0f, 1.0f };
+};
+
+/* Size in bytes of one encoded attribute with 'components' components */
+uint32_t vertexAttributeSize(uint32_t encoding, uint32_t components);
+
+/* Size in bytes of one encoded vertex, over all streams */
+uint32_t vertexFormatStride(const VertexFormat& fmt);
+
+/* Number of vertex streams: 2 for eVertexLayout_Split with texCoords or normals, 1 otherwise */
+uint32_t vertexFormatStreamCount(const VertexFormat& fmt);
+
+/* Size in bytes of one vertex in 'stream' */
+uint32_t vertexFormatStreamStride(const VertexFormat& fmt, uint32_t stream);
+
+/* Number of floats of an unencoded vertex: 3 for the position, 2 for texCoords, 3 for normals */
+uint32_t vertexFormatFloatCount(const VertexFormat& fmt);
+
 struct Mesh final
 {
     /* Number of LODs on this mesh*/
@@ -28,15 +167,28 @@ struct Mesh final
     uint32_t materialID = 0;
 
     /* equal to the total sum of all LOD index array sizes and the sum of all stream sizes */
-    uint32_t meshSize;
+    uint32_t meshSize = 0;
 
     /* The number of vertices in this mesh */
-    uint32_t vertexCount;
+    uint32_t vertexCount = 0;
+
+    /* Size of one index in bytes: 2 when all vertices fit in 16 bits, 4 otherwise.
+     * Indices are local to the mesh, streamOffset[0] is the base vertex.
+     */
+    uint32_t indexSize = sizeof(uint32_t);
 
-    /* Contains all the offsets to the LOD index data. 
+    /* Contains all the byte offsets to the LOD index data; the first LOD of a mesh starts at a 4-byte boundary. 
      * Extra space at the end is a marker to calculate the size of last LOD. 
      */
-    uint32_t lodOffset[kMaxLODs];
+    uint32_t lodOffset[kMaxLODs + 1] = {};
+
+    /* Object space simplification error of each LOD, 0 for LOD 0.
+     * Projecting it to the screen gives the pixel error when picking a LOD.
+     */
+    float lodError[kMaxLODs] = {};
+
+    /* Explicit padding, so every byte written to a file is defined */
+    uint32_t reserved0 = 0;
 
     /**
      * we use a function to calculate the size;
@@ -49,30 +201,112 @@ struct Mesh final
     /**
      *  stores offsets to all the individual vertex data streams (vertex attribute arrays)
      */
-    uint64_t streamOffset[kMaxStreams];
+    uint64_t streamOffset[kMaxStreams] = {};
     
     /**
      * contains the element size for each attribute in vertex streams
      */
-    uint32_t streamElementSize[kMaxStreams];
+    uint32_t streamElementSize[kMaxStreams] = {};
+
+    /* Encoding of the vertex attributes, streamElementSize is derived from it */
+    VertexFormat vertexFormat;
+
+    /* Range of this mesh in the meshlet table, empty unless meshlets were generated */
+    uint32_t meshletOffset = 0;
+    uint32_t meshletCount = 0;
+
+    /* Entry of LOD 0 in the bounds table, followed by the entries of the other LODs */
+    uint32_t boundsOffset = 0;
+
+    uint32_t reserved1 = 0;
 };
 
+/**
+ * Mirror of the VertexFormat struct in shaders/VertexFormat.h (std430).
+ * Vertex pulling shaders index an array of these to decode vertices.
+ */
+struct GPUVertexFormat
+{
+    float positionOffset[4];
+    float positionScale[4];
+    float texCoordOffsetScale[4];
+    uint32_t position;
+    uint32_t texCoord;
+    uint32_t normal;
+    /* Stride of the stream holding the positions, in 32-bit words */
+    uint32_t stride;
+    /* First word of the position stream of the mesh */
+    uint32_t vertexBase;
+    /* Size of one index in bytes */
+    uint32_t indexSize;
+    /* First word of the texCoord of vertex 0, in the position stream for interleaved vertices */
+    uint32_t attributeBase;
+    /* Stride of the stream holding texCoords and normals, in 32-bit words */
+    uint32_t attributeStride;
+};
+
+GPUVertexFormat gpuVertexFormat(const Mesh& mesh);
+
+/**
+ * File layout:
+ *   MeshFileHeader | Mesh[meshCount] | index data | vertex data | Meshlet[meshletCount] | meshlet vertices | meshlet triangles |
+ *   MeshBounds[boundsCount]
+ * Index data starts at dataBlockStartOffset, vertex data immediately follows its storedIndexDataSize bytes.
+ * With eIndexCodec_Meshopt the index block is a sequence of (uint32_t size, encoded bytes) pairs, one per mesh LOD
+ * in mesh order, padded to 4 bytes at the end. With eVertexCodec_Meshopt the vertex block is the same, with one pair
+ * per vertex stream of every mesh.
+ */
 struct MeshFileHeader
 {
     /* Hexadecimal value at top of file */
     uint32_t magicValue;
 
+    /* Layout version, equal to kMeshFileVersion */
+    uint32_t version;
+
     /* The number of different meshes in this file */
     uint32_t meshCount;
 
     /* The offset to the beginning of the mesh data */
     uint32_t dataBlockStartOffset;
 
-    /* index size in bytes */
-    uint32_t indexDataSize;
+    /* index size in bytes, after decoding */
+    uint64_t indexDataSize;
+
+    /* vertex size in bytes, after decoding */
+    uint64_t vertexDataSize;
+
+    /* Hash of everything after the header as stored in the file, see meshDataChecksum() */
+    uint64_t checksum;
+
+    /* eIndexCodec of the index block */
+    uint32_t indexCodec;
+
+    /* eVertexCodec of the vertex block */
+    uint32_t vertexCodec;
+
+    /* Size in bytes of the index block in the file, equal to indexDataSize for eIndexCodec_None */
+    uint64_t storedIndexDataSize;
+
+    /* The number of entries in the meshlet table */
+    uint32_t meshletCount;
+
+    /* The number of uint32_t entries in the meshlet vertex table */
+    uint32_t meshletVertexCount;
+
+    /* Size in bytes of the meshlet triangle table, a multiple of 4 */
+    uint64_t meshletTriangleDataSize;
+
+    /* Hash of the source asset and the converter options that produced this file, 0 if unknown */
+    uint64_t sourceKey;
+
+    /* The number of entries in the bounds table, one per mesh LOD */
+    uint32_t boundsCount;
 
-    /* vertex size in bytes */
-    uint32_t vertexDataSize;
+    uint32_t reserved;
+
+    /* Size in bytes of the vertex block in the file, equal to vertexDataSize for eVertexCodec_None */
+    uint64_t storedVertexDataSize;
 };
 
 struct DrawData
@@ -84,14 +318,6 @@ struct DrawData
     uint32_t transformIndex;
 };
 
-struct MeshData
-{
-    std::vector<uint32_t> indexData;
-    std::vector<float> vertexData;
-    std::vector<Mesh> meshes;
-    std::vector<BoundingBox> boxes;
-};
-
 struct InstanceData
 {
     float transform[16];
@@ -99,4 +325,175 @@ struct InstanceData
     uint32_t materialIndex = 0;
     uint32_t LOD = 0;
     uint32_t m_indexOffset = 0;
-};
\ No newline at end of file
+};
+
+/* A run of instances with the same material, drawn with one multi-draw indirect call */
+struct DrawBatch
+{
+    uint32_t materialIndex;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
+
+/* Orders instances by material, then mesh, so each material is one contiguous batch */
+void sortInstances(std::span<InstanceData> instances);
+
+/* Splits instances into runs of equal materials; one batch per material if they are sorted */
+std::vector<DrawBatch> buildDrawBatches(std::span<const InstanceData> instances);
+
+struct MeshData
+{
+    std::vector<uint8_t> indexData;
+    std::vector<uint8_t> vertexData;
+    std::vector<Mesh> meshes;
+    /* Box of LOD 0 of every mesh, the same as in 'bounds' */
+    std::vector<BoundingBox> boxes;
+    std::vector<MeshBounds> bounds;
+
+    /* One entry per placed source mesh; deduplicated meshes are referenced by several instances */
+    std::vector<InstanceData> instances;
+
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> meshletVertices;
+    std::vector<uint8_t> meshletTriangles;
+};
+
+/**
+ * Read-only view of a memory mapped mesh file.
+ * The spans point straight into the mapping and stay valid until unmapMeshFile().
+ */
+struct MeshFileView
+{
+    MeshFileHeader header = {};
+
+    std::span<const Mesh> meshes;
+    std::span<const uint8_t> indexData;
+    std::span<const uint8_t> vertexData;
+
+    std::span<const Meshlet> meshlets;
+    std::span<const uint32_t> meshletVertices;
+    std::span<const uint8_t> meshletTriangles;
+
+    std::span<const MeshBounds> bounds;
+
+    void* mappedPtr = nullptr;
+    size_t mappedSize = 0;
+
+    /* Backing storage of indexData and vertexData when the blocks were compressed */
+    std::vector<uint8_t> decodedIndexData;
+    std::vector<uint8_t> decodedVertexData;
+};
+
+uint64_t meshDataChecksum(
+    std::span<const Mesh> meshes, std::span<const uint8_t> indexData, std::span<const uint8_t> vertexData,
+    std::span<const Meshlet> meshlets, std::span<const uint32_t> meshletVertices, std::span<const uint8_t> meshletTriangles,
+    std::span<const MeshBounds> bounds);
+
+/**
+ * Bounds of the triangles in 'indices'. Positions are the first three floats of each vertex, 'stride' floats apart.
+ */
+MeshBounds computeMeshBounds(const float* vertices, size_t stride, const uint32_t* indices, size_t indexCount);
+
+inline BoundingBox getBoundingBox(const MeshBounds& b)
+{
+    return BoundingBox(glm::vec3(b.boxMin[0], b.boxMin[1], b.boxMin[2]), glm::vec3(b.boxMax[0], b.boxMax[1], b.boxMax[2]));
+}
+
+/* Fills in the dequantization ranges of 'fmt' from the bounds of unencoded vertices */
+void computeVertexFormatRanges(VertexFormat& fmt, const float* vertices, size_t vertexCount);
+
+/**
+ * Encodes unencoded vertices (vertexFormatFloatCount() floats each) into vertexCount * vertexFormatStride() bytes.
+ * Streams are stored one after the other, stream 1 starts at vertexCount * vertexFormatStreamStride(fmt, 0).
+ */
+void encodeVertices(const VertexFormat& fmt, const float* vertices, size_t vertexCount, uint8_t* dst);
+
+/* Decodes the position of one encoded vertex */
+glm::vec3 decodeVertexPosition(const VertexFormat& fmt, const uint8_t* vertex);
+
+bool saveMeshData(FILE* f, const MeshData& m, uint32_t indexCodec = eIndexCodec_None, uint32_t vertexCodec = eVertexCodec_None, uint64_t sourceKey = 0);
+
+bool saveMeshData(const char* fileName, const MeshData& m, uint32_t indexCodec = eIndexCodec_None, uint32_t vertexCodec = eVertexCodec_None, uint64_t sourceKey = 0);
+
+/**
+ * Writes a mesh file one mesh at a time, for inputs that do not fit in memory as a whole.
+ * Index data goes to the file as soon as a mesh is added; the sections that follow it are spooled to
+ * temporary files next to it. close() appends them, then backpatches the header and the Mesh table.
+ * Only the Mesh table is kept in memory. The result is identical to saveMeshData() with the same meshes.
+ */
+class MeshFileWriter
+{
+public:
+
+    MeshFileWriter() = default;
+    /* Removes an unfinished file */
+    ~MeshFileWriter();
+
+    MeshFileWriter(const MeshFileWriter&) = delete;
+    MeshFileWriter& operator=(const MeshFileWriter&) = delete;
+
+    /* Exactly 'meshCount' meshes have to be added before close() */
+    bool open(const char* fileName, uint32_t meshCount, uint32_t indexCodec = eIndexCodec_None, uint32_t vertexCodec = eVertexCodec_None, uint64_t sourceKey = 0);
+
+    /* Offsets in 'mesh' and 'meshlets' are relative to the given buffers; they are rebased when written */
+    bool addMesh(const Mesh& mesh, std::span<const MeshBounds> bounds, std::span<const uint8_t> indexData, std::span<const uint8_t> vertexData,
+        std::span<const Meshlet> meshlets, std::span<const uint32_t> meshletVertices, std::span<const uint8_t> meshletTriangles);
+
+    bool close();
+
+    /* Mesh table as written so far, offsets rebased into the file */
+    inline const std::vector<Mesh>& getMeshes() const { return m_meshes; }
+
+private:
+
+    /* A section of the file after the index block, spooled to its own temporary file */
+    struct Spool
+    {
+        FILE* file = nullptr;
+        std::string fileName;
+        HashStream hash;
+        uint64_t size = 0;
+    };
+
+    enum
+    {
+        eSpool_Vertices = 0,
+        eSpool_Meshlets,
+        eSpool_MeshletVertices,
+        eSpool_MeshletTriangles,
+        eSpool_Bounds,
+        eSpool_Count
+    };
+
+    bool write(Spool& spool, const void* data, size_t size);
+
+    void abandon();
+
+    FILE* m_file = nullptr;
+    std::string m_fileName;
+    uint32_t m_meshCount = 0;
+    uint32_t m_indexCodec = eIndexCodec_None;
+    uint32_t m_vertexCodec = eVertexCodec_None;
+    uint64_t m_sourceKey = 0;
+
+    std::vector<Mesh> m_meshes;
+    uint64_t m_indexDataSize = 0;
+    uint64_t m_vertexDataSize = 0;
+    // the index block is written straight to m_file
+    Spool m_index;
+    Spool m_spools[eSpool_Count];
+};
+
+/* Writes 'instances' as a flat array, the drawDataFile format of VulkanMultiMeshRenderer */
+bool saveInstanceData(const char* fileName, std::span<const InstanceData> instances);
+
+/* Reads only the header of a mesh file; false if it cannot be read or is not a mesh file of the current version */
+bool readMeshFileHeader(const char* fileName, MeshFileHeader& header);
+
+/**
+ * Maps 'fileName' and decodes compressed blocks into the view. With a pool the meshes are decoded in parallel,
+ * otherwise on the calling thread.
+ */
+bool mapMeshFile(const char* fileName, MeshFileView& view, bool verifyChecksum = false, ThreadPool* pool = nullptr);
+
+void unmapMeshFile(MeshFileView& view);
\ No newline at end of file
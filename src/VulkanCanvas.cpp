@@ -40,10 +40,9 @@ VulkanCanvas::VulkanCanvas(VulkanRenderDevice &vkDev, VulkanImage depth) :
     if (!createColorAndDepthRenderPass(vkDev, (depth.image != VK_NULL_HANDLE), &m_renderPass, RenderPassCreateInfo()) ||
         !createUniformBuffers(vkDev, sizeof(UniformBuffer)) ||
         !createColorAndDepthFramebuffers(vkDev, m_renderPass, depth.imageView, m_swapchainFramebuffers) ||
-        !createDescriptorPool(vkDev, 1, 1, 0, &m_descriptorPool) ||
+        !createDescriptorLayouts(vkDev, shaders) ||
         !createDescriptorSet(vkDev) ||
-        !createPipelineLayout(vkDev.device, m_descriptorSetLayout, &m_pipelineLayout) ||
-        !createGraphicsPipeline(vkDev, m_renderPass, m_pipelineLayout, shaders, &m_graphicsPipeline, VK_PRIMITIVE_TOPOLOGY_LINE_LIST, (depth.image != VK_NULL_HANDLE), true))
+        !createPipeline(vkDev, shaders, VK_PRIMITIVE_TOPOLOGY_LINE_LIST, (depth.image != VK_NULL_HANDLE), true))
     {
         printf("VulkanCanvas: failed to create pipeline\n");
         exit(EXIT_FAILURE);
@@ -139,33 +138,10 @@ void VulkanCanvas::plane3d(const vec3 &origin, const vec3 &v1, const vec3 &v2, i
 
 bool VulkanCanvas::createDescriptorSet(VulkanRenderDevice &vkDev)
 {
-    const std::array <VkDescriptorSetLayoutBinding, 2> bindings =
+    if(!allocateDescriptorSets(vkDev))
     {
-        descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
-        descriptorSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
-    };
-
-    const VkDescriptorSetLayoutCreateInfo layoutInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .bindingCount = static_cast<uint32_t>(bindings.size()),
-        .pBindings = bindings.data()
-    };
-    VK_CHECK(vkCreateDescriptorSetLayout(vkDev.device, &layoutInfo, nullptr, &m_descriptorSetLayout));
-
-    std::vector<VkDescriptorSetLayout> layouts(vkDev.swapchainImages.size(), m_descriptorSetLayout);
-    const VkDescriptorSetAllocateInfo allocInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .pNext = nullptr,
-        .descriptorPool = m_descriptorPool,
-        .descriptorSetCount = static_cast<uint32_t>(vkDev.swapchainImages.size()),
-        .pSetLayouts = layouts.data()
-    };
-    m_descriptorSets.resize(vkDev.swapchainImages.size());
-    VK_CHECK(vkAllocateDescriptorSets(vkDev.device, &allocInfo, m_descriptorSets.data()));
+        return false;
+    }
 
     for(size_t i = 0; i < vkDev.swapchainImages.size(); i++)
     {
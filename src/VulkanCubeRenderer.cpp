@@ -24,10 +24,9 @@ VulkanCubeRenderer::VulkanCubeRenderer(VulkanRenderDevice &vkDev, VulkanImage in
     if( !createColorAndDepthRenderPass(vkDev, true, &m_renderPass, RenderPassCreateInfo()) ||
         !createUniformBuffers(vkDev, sizeof(mat4)) ||
         !createColorAndDepthFramebuffers(vkDev, m_renderPass, m_depthTexture.imageView, m_swapchainFramebuffers) ||
-        !createDescriptorPool(vkDev, 1, 0, 1, &m_descriptorPool) ||
+        !createDescriptorLayouts(vkDev, shaders) ||
         !createDescriptorSet(vkDev) ||
-        !createPipelineLayout(vkDev.device, m_descriptorSetLayout, &m_pipelineLayout) ||
-        !createGraphicsPipeline(vkDev, m_renderPass, m_pipelineLayout, shaders, &m_graphicsPipeline))
+        !createPipeline(vkDev, shaders))
     {
         printf("VulkanCubeRenderer: failed to create pipeline\n");
         exit(EXIT_FAILURE);
@@ -54,34 +53,10 @@ void VulkanCubeRenderer::updateUniformBuffer(VulkanRenderDevice &vkDev, uint32_t
 
 bool VulkanCubeRenderer::createDescriptorSet(VulkanRenderDevice &vkDev)
 {
-    const std::array<VkDescriptorSetLayoutBinding, 2> bindings =
+    if(!allocateDescriptorSets(vkDev))
     {
-        descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
-        descriptorSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-    };
-
-    const VkDescriptorSetLayoutCreateInfo layoutInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .bindingCount = static_cast<uint32_t>(bindings.size()),
-        .pBindings = bindings.data()
-    };
-    VK_CHECK(vkCreateDescriptorSetLayout(vkDev.device, &layoutInfo, nullptr, &m_descriptorSetLayout));
-
-    std::vector<VkDescriptorSetLayout> layouts(vkDev.swapchainImages.size(), m_descriptorSetLayout);
-
-    const VkDescriptorSetAllocateInfo allocInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .pNext = nullptr,
-        .descriptorPool = m_descriptorPool,
-        .descriptorSetCount = static_cast<uint32_t>(vkDev.swapchainImages.size()),
-        .pSetLayouts = layouts.data()
-    };
-    m_descriptorSets.resize(vkDev.swapchainImages.size());
-    VK_CHECK(vkAllocateDescriptorSets(vkDev.device, &allocInfo, m_descriptorSets.data()));
+        return false;
+    }
 
     for(size_t i = 0; i < vkDev.swapchainImages.size(); i++)
     {
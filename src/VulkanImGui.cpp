@@ -124,11 +124,9 @@ VulkanImGui::VulkanImGui(VulkanRenderDevice &vkDev) :
     if( !createColorAndDepthRenderPass(vkDev, false, &m_renderPass, RenderPassCreateInfo()) ||
         !createColorAndDepthFramebuffers(vkDev, m_renderPass, VK_NULL_HANDLE, m_swapchainFramebuffers) ||
         !createUniformBuffers(vkDev, sizeof(mat4)) ||
-        !createDescriptorPool(vkDev, 1, 2, 1, &m_descriptorPool) ||
+        !createDescriptorLayouts(vkDev, shaders) ||
         !createDescriptorSet(vkDev) ||
-        !createPipelineLayout(vkDev.device, m_descriptorSetLayout, &m_pipelineLayout) ||
-        // !createPipelineLayoutWithConstants(vkDev.device, m_descriptorSetLayout, &m_pipelineLayout, 0, sizeof(uint32_t)) ||
-        !createGraphicsPipeline(vkDev, m_renderPass, m_pipelineLayout, shaders, &m_graphicsPipeline, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, true, true, true))
+        !createPipeline(vkDev, shaders, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, true, true, true))
     {
         printf("VulkanImGui: pipeline creation failed\n");
         exit(EXIT_FAILURE);
@@ -211,35 +209,10 @@ void VulkanImGui::updateBuffers(VulkanRenderDevice &vkDev, uint32_t currentImage
 
 bool VulkanImGui::createDescriptorSet(VulkanRenderDevice &vkDev)
 {
-    const std::array<VkDescriptorSetLayoutBinding, 4> bindings =
+    if(!allocateDescriptorSets(vkDev))
     {
-        descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
-        descriptorSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
-        descriptorSetLayoutBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
-        descriptorSetLayoutBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-    };
-
-    const VkDescriptorSetLayoutCreateInfo layoutInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .bindingCount = static_cast<uint32_t>(bindings.size()),
-        .pBindings = bindings.data()
-    };
-    VK_CHECK(vkCreateDescriptorSetLayout(vkDev.device, &layoutInfo, nullptr, &m_descriptorSetLayout));
-
-    std::vector<VkDescriptorSetLayout> layouts(vkDev.swapchainImages.size(), m_descriptorSetLayout);
-    const VkDescriptorSetAllocateInfo allocInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .pNext = nullptr,
-        .descriptorPool = m_descriptorPool,
-        .descriptorSetCount = static_cast<uint32_t>(vkDev.swapchainImages.size()),
-        .pSetLayouts = layouts.data()
-    };
-    m_descriptorSets.resize(vkDev.swapchainImages.size());
-    VK_CHECK(vkAllocateDescriptorSets(vkDev.device, &allocInfo, m_descriptorSets.data()));
+        return false;
+    }
 
     for(size_t i = 0; i < vkDev.swapchainImages.size(); i++)
     {
@@ -1,26 +1,105 @@
 #include "VulkanModelRenderer.h"
+#include "VKShader.h"
+#include "MeshConvert.h"
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <array>
+#include <algorithm>
+#include <string>
 
-VulkanModelRenderer::VulkanModelRenderer(VulkanRenderDevice &vkDev, const char *modelFile, const char *textureFile, uint32_t uniformDataSize) :
+VulkanModelRenderer::VulkanModelRenderer(VulkanRenderDevice &vkDev, const char *modelFile, const char *textureFile, uint32_t uniformDataSize, bool wireframe) :
     VulkanRendererBase(vkDev, VulkanImage())
 {
-    if(!createTexturedVertexBuffer(vkDev, modelFile, &m_storageBuffer, &m_storageBufferMemory, &m_vertexBufferSize, &m_indexBufferSize))
+    // all meshes are drawn with one indirect call, each command selecting its mesh with firstInstance
+    if(!hasIndirectDrawFeatures(vkDev.physicalDevice))
     {
-        printf("VulkanModelRenderer: createTexturedVertexBuffer failed\n");
+        printf("VulkanModelRenderer: multiDrawIndirect and drawIndirectFirstInstance are required\n");
         exit(EXIT_FAILURE);
     }
-    createTextureImage(vkDev, textureFile, m_texture.image, m_texture.imageMemory);
-    createImageView(vkDev.device, m_texture.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, &m_texture.imageView);
-    createTextureSampler(vkDev.device, &m_textureSampler);
 
+    // source assets are converted once into a .mesh file next to them, later runs only map it
+    const std::string meshFile = endsWith(modelFile, ".mesh") ? std::string(modelFile) : std::string(modelFile) + ".mesh";
+    MeshConvertOptions convertOptions;
+    convertOptions.exportTextures = true;
+    convertOptions.optimize = true;
+    convertOptions.setQuantized();
+    if(meshFile != modelFile && !convertMeshFileIfStale(modelFile, meshFile.c_str(), convertOptions))
+    {
+        printf("VulkanModelRenderer: cannot convert '%s'\n", modelFile);
+        exit(EXIT_FAILURE);
+    }
+    if(!createMeshFileVertexBuffer(vkDev, meshFile.c_str(), &m_storageBuffer, &m_storageBufferMemory, &m_vertexBufferSize, &m_indexBufferSize, &m_meshes))
+    {
+        printf("VulkanModelRenderer: createMeshFileVertexBuffer failed\n");
+        exit(EXIT_FAILURE);
+    }
 
-    std::vector<const char*> shaders = 
+    std::vector<GPUVertexFormat> vertexFormats;
+    vertexFormats.reserve(m_meshes.size());
+    for(const Mesh& mesh : m_meshes)
+    {
+        vertexFormats.push_back(gpuVertexFormat(mesh));
+    }
+    m_vertexFormatSize = vertexFormats.size() * sizeof(GPUVertexFormat);
+    if(!createBuffer(
+        vkDev.device, vkDev.physicalDevice, m_vertexFormatSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        m_vertexFormatBuffer, m_vertexFormatBufferMemory))
+    {
+        printf("VulkanModelRenderer: cannot create vertex format buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    uploadBufferData(vkDev, m_vertexFormatBufferMemory, 0, vertexFormats.data(), m_vertexFormatSize);
+
+    // gl_VertexIndex starts at firstVertex, which selects the LOD 0 range of the index buffer;
+    // firstInstance picks the vertex format of the mesh
+    std::vector<VkDrawIndirectCommand> drawCommands;
+    drawCommands.reserve(m_meshes.size());
+    for(uint32_t i = 0; i != m_meshes.size(); i++)
+    {
+        const Mesh& mesh = m_meshes[i];
+        drawCommands.push_back(VkDrawIndirectCommand
+        {
+            .vertexCount = static_cast<uint32_t>(mesh.getLODSize(0) / mesh.indexSize),
+            .instanceCount = 1,
+            .firstVertex = mesh.lodOffset[0] / mesh.indexSize,
+            .firstInstance = i
+        });
+    }
+    m_drawCount = static_cast<uint32_t>(drawCommands.size());
+    const size_t indirectDataSize = std::max<size_t>(drawCommands.size(), 1) * sizeof(VkDrawIndirectCommand);
+    if(!createBuffer(
+        vkDev.device, vkDev.physicalDevice, indirectDataSize,
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        m_indirectBuffer, m_indirectBufferMemory))
+    {
+        printf("VulkanModelRenderer: cannot create indirect buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    if(m_drawCount)
+    {
+        uploadBufferData(vkDev, m_indirectBufferMemory, 0, drawCommands.data(), m_drawCount * sizeof(VkDrawIndirectCommand));
+    }
+
+    m_bTextured = textureFile != nullptr;
+    if(m_bTextured)
+    {
+        createTextureImage(vkDev, textureFile, m_texture.image, m_texture.imageMemory);
+        createImageView(vkDev.device, m_texture.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, &m_texture.imageView);
+        createTextureSampler(vkDev.device, &m_textureSampler);
+    }
+
+    // texturing is a define, so the untextured shader has no sampler binding at all;
+    // the wireframe is a specialization constant of the same SPIR-V (constant_id 0 of VK02.frag)
+    const std::vector<ShaderVariant> shaders =
     {
         "shaders/VK02.vert",
-        "shaders/VK02.frag",
+        ShaderVariant(
+            "shaders/VK02.frag",
+            m_bTextured ? std::vector<std::string>{ "TEXTURED" } : std::vector<std::string>{},
+            ShaderSpecialization().set(0, wireframe)),
         "shaders/VK02.geom"
     };
 
@@ -28,10 +107,9 @@ VulkanModelRenderer::VulkanModelRenderer(VulkanRenderDevice &vkDev, const char *
         !createColorAndDepthRenderPass(vkDev, true, &m_renderPass, RenderPassCreateInfo()) ||
         !createUniformBuffers(vkDev, uniformDataSize) ||
         !createColorAndDepthFramebuffers(vkDev, m_renderPass, m_depthTexture.imageView, m_swapchainFramebuffers) ||
-        !createDescriptorPool(vkDev, 1, 2, 1, &m_descriptorPool) ||
+        !createDescriptorLayouts(vkDev, shaders) ||
         !createDescriptorSet(vkDev, uniformDataSize) ||
-        !createPipelineLayout(vkDev.device, m_descriptorSetLayout, &m_pipelineLayout) ||
-        !createGraphicsPipeline(vkDev, m_renderPass, m_pipelineLayout, shaders, &m_graphicsPipeline))
+        !createPipeline(vkDev, shaders))
     {
         printf("VulkanModelRenderer: failed to create pipeline\n");
         exit(EXIT_FAILURE);
@@ -43,8 +121,17 @@ VulkanModelRenderer::~VulkanModelRenderer()
     vkDestroyBuffer(*p_dev, m_storageBuffer, nullptr);
     vkFreeMemory(*p_dev, m_storageBufferMemory, nullptr);
 
-    vkDestroySampler(*p_dev, m_textureSampler, nullptr);
-    destroyVulkanImage(*p_dev, m_texture);
+    vkDestroyBuffer(*p_dev, m_vertexFormatBuffer, nullptr);
+    vkFreeMemory(*p_dev, m_vertexFormatBufferMemory, nullptr);
+
+    vkDestroyBuffer(*p_dev, m_indirectBuffer, nullptr);
+    vkFreeMemory(*p_dev, m_indirectBufferMemory, nullptr);
+
+    if(m_bTextured)
+    {
+        vkDestroySampler(*p_dev, m_textureSampler, nullptr);
+        destroyVulkanImage(*p_dev, m_texture);
+    }
 
     if(!bIsExternalDepth)
     {
@@ -55,7 +142,7 @@ VulkanModelRenderer::~VulkanModelRenderer()
 void VulkanModelRenderer::fillCommandBuffer(const VkCommandBuffer &commandBuffer, size_t currentImage)
 {
     beginRenderPass(commandBuffer, currentImage);
-    vkCmdDraw(commandBuffer, static_cast<uint32_t>(m_indexBufferSize/(sizeof(uint32_t))), 1, 0, 0);
+    vkCmdDrawIndirect(commandBuffer, m_indirectBuffer, 0, m_drawCount, sizeof(VkDrawIndirectCommand));
     vkCmdEndRenderPass(commandBuffer);
 }
 
@@ -66,35 +153,10 @@ void VulkanModelRenderer::updateUniformBuffer(VulkanRenderDevice &vkDev, uint32_
 
 bool VulkanModelRenderer::createDescriptorSet(VulkanRenderDevice &vkDev, uint32_t uniformDataSize)
 {
-    const std::array<VkDescriptorSetLayoutBinding, 4> bindings =
+    if(!allocateDescriptorSets(vkDev))
     {
-        descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
-        descriptorSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
-        descriptorSetLayoutBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
-        descriptorSetLayoutBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-    };
-
-    const VkDescriptorSetLayoutCreateInfo layoutInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .bindingCount = static_cast<uint32_t>(bindings.size()),
-        .pBindings = bindings.data()
-    };
-    VK_CHECK(vkCreateDescriptorSetLayout(vkDev.device, &layoutInfo, nullptr, &m_descriptorSetLayout));
-
-    std::vector<VkDescriptorSetLayout> layouts(vkDev.swapchainImages.size(), m_descriptorSetLayout);
-    const VkDescriptorSetAllocateInfo allocInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .pNext = nullptr,
-        .descriptorPool = m_descriptorPool,
-        .descriptorSetCount = static_cast<uint32_t>(layouts.size()),
-        .pSetLayouts = layouts.data()
-    };
-    m_descriptorSets.resize(vkDev.swapchainImages.size());
-    VK_CHECK(vkAllocateDescriptorSets(vkDev.device, &allocInfo, m_descriptorSets.data()));
+        return false;
+    }
 
     for(size_t i = 0; i < vkDev.swapchainImages.size(); i++)
     {
@@ -103,15 +165,21 @@ bool VulkanModelRenderer::createDescriptorSet(VulkanRenderDevice &vkDev, uint32_
         const VkDescriptorBufferInfo bufferInfo1 = { m_uniformBuffers[i], 0, uniformDataSize};
         const VkDescriptorBufferInfo bufferInfo2 = { m_storageBuffer, 0, m_vertexBufferSize };
         const VkDescriptorBufferInfo bufferInfo3 = { m_storageBuffer, m_vertexBufferSize, m_indexBufferSize };
+        const VkDescriptorBufferInfo bufferInfo4 = { m_vertexFormatBuffer, 0, m_vertexFormatSize };
         const VkDescriptorImageInfo imageInfo = { m_textureSampler, m_texture.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
 
-        const std::array<VkWriteDescriptorSet, 4> descriptorWrites =
+        std::vector<VkWriteDescriptorSet> descriptorWrites =
         {
             bufferWriteDescriptorSet(ds, &bufferInfo1, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
             bufferWriteDescriptorSet(ds, &bufferInfo2, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
             bufferWriteDescriptorSet(ds, &bufferInfo3, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
-            imageWriteDescriptorSet(ds, &imageInfo, 3)
+            bufferWriteDescriptorSet(ds, &bufferInfo4, 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
         };
+        // the untextured variant has no binding 3
+        if(m_bTextured)
+        {
+            descriptorWrites.push_back(imageWriteDescriptorSet(ds, &imageInfo, 3));
+        }
 
         vkUpdateDescriptorSets(vkDev.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
     }
@@ -1,12 +1,14 @@
 #pragma once
 
 #include "VulkanRendererBase.h"
+#include "VtxData.h"
 
 class VulkanModelRenderer : public VulkanRendererBase
 {
 public:
 
-    VulkanModelRenderer(VulkanRenderDevice& vkDev, const char* modelFile, const char* textureFile, uint32_t uniformDataSize);
+    /* Without a texture (nullptr) the mesh is shaded with its vertex colors; 'wireframe' draws the triangle edges on top */
+    VulkanModelRenderer(VulkanRenderDevice& vkDev, const char* modelFile, const char* textureFile, uint32_t uniformDataSize, bool wireframe = true);
 
     virtual ~VulkanModelRenderer();
 
@@ -18,13 +20,26 @@ private:
 
     bool bIsExternalDepth = false;
 
+    std::vector<Mesh> m_meshes;
+
     size_t m_vertexBufferSize;
     size_t m_indexBufferSize;
     VkBuffer m_storageBuffer;
     VkDeviceMemory m_storageBufferMemory;
 
-    VkSampler m_textureSampler;
-    VulkanImage m_texture;
+    // one GPUVertexFormat per mesh, indexed with gl_BaseInstance
+    VkBuffer m_vertexFormatBuffer;
+    VkDeviceMemory m_vertexFormatBufferMemory;
+    size_t m_vertexFormatSize;
+
+    // one VkDrawIndirectCommand per mesh, all drawn with a single vkCmdDrawIndirect
+    VkBuffer m_indirectBuffer;
+    VkDeviceMemory m_indirectBufferMemory;
+    uint32_t m_drawCount = 0;
+
+    VkSampler m_textureSampler = VK_NULL_HANDLE;
+    VulkanImage m_texture = {};
+    bool m_bTextured = false;
 
     bool createDescriptorSet(VulkanRenderDevice& vkDev, uint32_t uniformDataSize);
 
@@ -1,5 +1,213 @@
 #include "VulkanMultiMeshRenderer.h"
+#include "UtilsThreadPool.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <array>
+#include <algorithm>
+
+#include <glm/ext.hpp>
+
+
+VulkanMultiMeshRenderer::VulkanMultiMeshRenderer(
+        VulkanRenderDevice &vkDev,
+        const char *meshFile,
+        const char *drawDataFile,
+        const char *materialFile,
+        const char *vtxShaderFile,
+        const char *fragShaderFile
+    ) :
+    VulkanRendererBase(vkDev, VulkanImage()),
+    vkDev(vkDev)
+{
+    // a batch is one indirect call with several commands, each fetching its InstanceData with gl_BaseInstance
+    if(!hasIndirectDrawFeatures(vkDev.physicalDevice))
+    {
+        printf("VulkanMultiMeshRenderer: multiDrawIndirect and drawIndirectFirstInstance are required\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(!createColorAndDepthRenderPass(vkDev, true, &m_renderPass, RenderPassCreateInfo()) ||
+       !createDepthResources(vkDev, vkDev.framebufferWidth, vkDev.framebufferHeight, m_depthTexture))
+    {
+        printf("VulkanMultiMeshRenderer: failed to create render pass\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // compressed blocks are decoded on all cores
+    ThreadPool loadPool;
+    MeshFileView meshView;
+    if(!mapMeshFile(meshFile, meshView, false, &loadPool))
+    {
+        printf("VulkanMultiMeshRenderer: failed to load '%s'\n", meshFile);
+        exit(EXIT_FAILURE);
+    }
+    meshes.assign(meshView.meshes.begin(), meshView.meshes.end());
+    if(!loadInstanceData(drawDataFile))
+    {
+        printf("VulkanMultiMeshRenderer: failed to load '%s'\n", drawDataFile);
+        exit(EXIT_FAILURE);
+    }
+
+    for(InstanceData& instance : instances)
+    {
+        instance.LOD = std::min(instance.LOD, meshes[instance.meshIndex].lodCount - 1);
+        instance.m_indexOffset = meshes[instance.meshIndex].lodOffset[instance.LOD] / meshes[instance.meshIndex].indexSize;
+    }
+    m_drawBatches = buildDrawBatches(instances);
+
+    // the index block is bound at an offset inside the same buffer
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vkDev.physicalDevice, &props);
+    const VkDeviceSize alignment = props.limits.minStorageBufferOffsetAlignment;
+
+    m_maxVertexBufferSize = (meshView.vertexData.size_bytes() + alignment - 1) & ~(alignment - 1);
+    m_maxIndexBufferSize = meshView.indexData.size_bytes();
+
+    m_maxInstances = static_cast<uint32_t>(instances.size());
+    m_maxInstanceSize = m_maxInstances * static_cast<uint32_t>(sizeof(InstanceData));
+    const uint32_t indirectDataSize = m_maxInstances * static_cast<uint32_t>(sizeof(VkDrawIndirectCommand));
+
+    std::vector<uint8_t> materials;
+    if(FILE* f = materialFile ? fopen(materialFile, "rb") : nullptr)
+    {
+        fseek(f, 0, SEEK_END);
+        const long fileSize = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if(fileSize < 0)
+        {
+            fclose(f);
+            printf("VulkanMultiMeshRenderer: cannot read '%s'\n", materialFile);
+            exit(EXIT_FAILURE);
+        }
+        materials.resize(fileSize);
+        materials.resize(fread(materials.data(), 1, materials.size(), f));
+        fclose(f);
+    }
+    // an empty material table still needs a valid buffer to bind
+    m_maxMaterialSize = static_cast<uint32_t>(materials.empty() ? sizeof(glm::vec4) : materials.size());
+
+    createBuffer(
+        vkDev.device, vkDev.physicalDevice, m_maxVertexBufferSize + m_maxIndexBufferSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        m_storageBuffer, m_storageBufferMemory
+    );
+    updateGeometryBuffers(
+        vkDev,
+        meshView.vertexData.size_bytes(), meshView.vertexData.data(),
+        meshView.indexData.size_bytes(), meshView.indexData.data()
+    );
+    unmapMeshFile(meshView);
+
+    createBuffer(
+        vkDev.device, vkDev.physicalDevice, m_maxMaterialSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        m_materialBuffer, m_materialBufferMemory
+    );
+    if(!materials.empty())
+    {
+        updateMaterialBuffer(vkDev, m_maxMaterialSize, materials.data());
+    }
+
+    std::vector<GPUVertexFormat> vertexFormats;
+    vertexFormats.reserve(meshes.size());
+    for(const Mesh& mesh : meshes)
+    {
+        vertexFormats.push_back(gpuVertexFormat(mesh));
+    }
+    m_vertexFormatSize = static_cast<uint32_t>(vertexFormats.size() * sizeof(GPUVertexFormat));
+
+    createBuffer(
+        vkDev.device, vkDev.physicalDevice, m_vertexFormatSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        m_vertexFormatBuffer, m_vertexFormatBufferMemory
+    );
+    uploadBufferData(vkDev, m_vertexFormatBufferMemory, 0, vertexFormats.data(), m_vertexFormatSize);
+
+    m_indirectBuffers.resize(vkDev.swapchainImages.size());
+    m_indirectBuffersMemory.resize(vkDev.swapchainImages.size());
+    m_instanceBuffers.resize(vkDev.swapchainImages.size());
+    m_instanceBuffersMemory.resize(vkDev.swapchainImages.size());
+
+    for(size_t i = 0; i < vkDev.swapchainImages.size(); i++)
+    {
+        createBuffer(
+            vkDev.device, vkDev.physicalDevice, indirectDataSize,
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            m_indirectBuffers[i], m_indirectBuffersMemory[i]
+        );
+        updateIndirectBuffers(vkDev, i);
+
+        createBuffer(
+            vkDev.device, vkDev.physicalDevice, m_maxInstanceSize,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            m_instanceBuffers[i], m_instanceBuffersMemory[i]
+        );
+        updateInstanceBuffer(vkDev, i, m_maxInstanceSize, instances.data());
+    }
+
+    const std::vector<const char*> shaders = { vtxShaderFile, fragShaderFile };
+
+    // the material table is bound for the fragment shader even while it does not read it
+    ShaderReflection reflection;
+    if(!reflectShaderFiles(shaders, reflection) ||
+       !addDescriptorBinding(reflection, 0, descriptorSetLayoutBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT)))
+    {
+        printf("VulkanMultiMeshRenderer: cannot reflect the shaders\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if( !createUniformBuffers(vkDev, sizeof(mat4)) ||
+        !createColorAndDepthFramebuffers(vkDev, m_renderPass, m_depthTexture.imageView, m_swapchainFramebuffers) ||
+        !createDescriptorLayouts(vkDev, reflection) ||
+        !createDescriptorSet(vkDev) ||
+        !createPipeline(vkDev, shaders))
+    {
+        printf("VulkanMultiMeshRenderer: failed to create pipeline\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+VulkanMultiMeshRenderer::~VulkanMultiMeshRenderer()
+{
+    vkDestroyBuffer(vkDev.device, m_storageBuffer, nullptr);
+    vkFreeMemory(vkDev.device, m_storageBufferMemory, nullptr);
+
+    vkDestroyBuffer(vkDev.device, m_materialBuffer, nullptr);
+    vkFreeMemory(vkDev.device, m_materialBufferMemory, nullptr);
+
+    vkDestroyBuffer(vkDev.device, m_vertexFormatBuffer, nullptr);
+    vkFreeMemory(vkDev.device, m_vertexFormatBufferMemory, nullptr);
+
+    for(size_t i = 0; i < m_indirectBuffers.size(); i++)
+    {
+        vkDestroyBuffer(vkDev.device, m_indirectBuffers[i], nullptr);
+        vkFreeMemory(vkDev.device, m_indirectBuffersMemory[i], nullptr);
+
+        vkDestroyBuffer(vkDev.device, m_instanceBuffers[i], nullptr);
+        vkFreeMemory(vkDev.device, m_instanceBuffersMemory[i], nullptr);
+    }
+
+    destroyVulkanImage(vkDev.device, m_depthTexture);
+}
+
+void VulkanMultiMeshRenderer::fillCommandBuffer(const VkCommandBuffer &commandBuffer, size_t currentImage)
+{
+    beginRenderPass(commandBuffer, currentImage);
+    for(const DrawBatch& batch : m_drawBatches)
+    {
+        vkCmdDrawIndirect(
+            commandBuffer, m_indirectBuffers[currentImage],
+            batch.firstInstance * sizeof(VkDrawIndirectCommand), batch.instanceCount, sizeof(VkDrawIndirectCommand));
+    }
+    vkCmdEndRenderPass(commandBuffer);
+}
 
 void VulkanMultiMeshRenderer::updateUniformBuffer(VulkanRenderDevice &vkDev, size_t currentImage, const mat4 &m)
 {
@@ -13,12 +221,105 @@ void VulkanMultiMeshRenderer::updateInstanceBuffer(VulkanRenderDevice &vkDev, si
 
 void VulkanMultiMeshRenderer::updateIndirectBuffers(VulkanRenderDevice &vkDev, size_t currentImage, bool *visibility)
 {
-    VkDrawIndexedIndirectCommand* data = nullptr;
-    
+    VkDrawIndirectCommand* data = nullptr;
+    vkMapMemory(vkDev.device, m_indirectBuffersMemory[currentImage], 0, m_maxInstances * sizeof(VkDrawIndirectCommand), 0, (void**)&data);
+
+    for(uint32_t i = 0; i < m_maxInstances; i++)
+    {
+        const Mesh& mesh = meshes[instances[i].meshIndex];
+        data[i] =
+        {
+            .vertexCount = static_cast<uint32_t>(mesh.getLODSize(instances[i].LOD) / mesh.indexSize),
+            .instanceCount = visibility ? (visibility[i] ? 1u : 0u) : 1u,
+            .firstVertex = 0,
+            // the vertex shader fetches its InstanceData with gl_BaseInstance
+            .firstInstance = i
+        };
+    }
+
+    vkUnmapMemory(vkDev.device, m_indirectBuffersMemory[currentImage]);
+}
+
+void VulkanMultiMeshRenderer::updateGeometryBuffers(VulkanRenderDevice &vkDev, VkDeviceSize vertexDataSize, const void *vertices, VkDeviceSize indexDataSize, const void *indices)
+{
+    uploadBufferData(vkDev, m_storageBufferMemory, 0, vertices, vertexDataSize);
+    uploadBufferData(vkDev, m_storageBufferMemory, m_maxVertexBufferSize, indices, indexDataSize);
+}
+
+void VulkanMultiMeshRenderer::updateMaterialBuffer(VulkanRenderDevice &vkDev, uint32_t materialSize, const void *materialData)
+{
+    uploadBufferData(vkDev, m_materialBufferMemory, 0, materialData, materialSize);
 }
 
-void VulkanMultiMeshRenderer::updateGeometryBuffers(VulkanRenderDevice &vkDev, uint32_t vertexCount, const void *vertices, uint32_t indexCount, const void *indices)
+bool VulkanMultiMeshRenderer::loadInstanceData(const char *drawDataFile)
 {
-    uploadBufferData(vkDev, m_storageBufferMemory, 0, vertices, vertexCount);
-    uploadBufferData(vkDev, m_storageBufferMemory, m_maxVertexBufferSize, indices, indexCount);
+    FILE* f = fopen(drawDataFile, "rb");
+    if(!f)
+    {
+        printf("I/O error. Cannot open '%s'\n", drawDataFile);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    const long fileSize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    // a partial record means the file was cut short or has another layout
+    if(fileSize <= 0 || (fileSize % sizeof(InstanceData)) != 0)
+    {
+        fclose(f);
+        printf("'%s': size %ld is not a multiple of %zu\n", drawDataFile, fileSize, sizeof(InstanceData));
+        return false;
+    }
+
+    instances.resize(fileSize / sizeof(InstanceData));
+    const size_t numRead = fread(instances.data(), sizeof(InstanceData), instances.size(), f);
+    fclose(f);
+
+    if(instances.empty() || numRead != instances.size()) { return false; }
+
+    // a stale or mismatched instance file must not index past the mesh table
+    for(size_t i = 0; i != instances.size(); i++)
+    {
+        if(instances[i].meshIndex >= meshes.size())
+        {
+            printf("'%s': instance %zu uses mesh %u, the mesh file has %zu\n", drawDataFile, i, instances[i].meshIndex, meshes.size());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VulkanMultiMeshRenderer::createDescriptorSet(VulkanRenderDevice &vkDev)
+{
+    if(!allocateDescriptorSets(vkDev))
+    {
+        return false;
+    }
+
+    for(size_t i = 0; i < vkDev.swapchainImages.size(); i++)
+    {
+        VkDescriptorSet ds = m_descriptorSets[i];
+
+        const VkDescriptorBufferInfo uniformInfo = { m_uniformBuffers[i], 0, sizeof(mat4) };
+        const VkDescriptorBufferInfo vertexInfo = { m_storageBuffer, 0, m_maxVertexBufferSize };
+        const VkDescriptorBufferInfo indexInfo = { m_storageBuffer, m_maxVertexBufferSize, m_maxIndexBufferSize };
+        const VkDescriptorBufferInfo instanceInfo = { m_instanceBuffers[i], 0, m_maxInstanceSize };
+        const VkDescriptorBufferInfo materialInfo = { m_materialBuffer, 0, m_maxMaterialSize };
+        const VkDescriptorBufferInfo vertexFormatInfo = { m_vertexFormatBuffer, 0, m_vertexFormatSize };
+
+        const std::array<VkWriteDescriptorSet, 6> descriptorWrites =
+        {
+            bufferWriteDescriptorSet(ds, &uniformInfo, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
+            bufferWriteDescriptorSet(ds, &vertexInfo, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+            bufferWriteDescriptorSet(ds, &indexInfo, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+            bufferWriteDescriptorSet(ds, &instanceInfo, 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+            bufferWriteDescriptorSet(ds, &materialInfo, 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+            bufferWriteDescriptorSet(ds, &vertexFormatInfo, 5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+        };
+
+        vkUpdateDescriptorSets(vkDev.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    return true;
 }
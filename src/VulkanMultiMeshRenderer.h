@@ -30,7 +30,7 @@ public:
 
     void updateIndirectBuffers(VulkanRenderDevice& vkDev, size_t currentImage, bool* visibility = nullptr);
 
-    void updateGeometryBuffers(VulkanRenderDevice& vkDev, uint32_t vertexCount,  const void* vertices, uint32_t indexCount, const void* indices);
+    void updateGeometryBuffers(VulkanRenderDevice& vkDev, VkDeviceSize vertexDataSize, const void* vertices, VkDeviceSize indexDataSize, const void* indices);
 
     void updateMaterialBuffer(VulkanRenderDevice& vkDev, uint32_t materialSize, const void* materialData);
 
@@ -42,16 +42,16 @@ private:
 
     std::vector<InstanceData> instances;
     std::vector<Mesh> meshes;
-    std::vector<uint32_t> indexData;
-    std::vector<float> vertexData;
+    // runs of instances sharing a material, one vkCmdDrawIndirect each
+    std::vector<DrawBatch> m_drawBatches;
 
     // uint32_t m_vertexBufferSize;
     // uint32_t m_indexBufferSize;
 
     VulkanRenderDevice& vkDev;
 
-    uint32_t m_maxVertexBufferSize;
-    uint32_t m_maxIndexBufferSize;
+    VkDeviceSize m_maxVertexBufferSize;
+    VkDeviceSize m_maxIndexBufferSize;
 
     uint32_t m_maxInstances;
     uint32_t m_maxInstanceSize;
@@ -67,6 +67,11 @@ private:
     VkBuffer m_materialBuffer;
     VkDeviceMemory m_materialBufferMemory;
 
+    // one GPUVertexFormat per mesh, indexed with InstanceData::meshIndex
+    VkBuffer m_vertexFormatBuffer;
+    VkDeviceMemory m_vertexFormatBufferMemory;
+    uint32_t m_vertexFormatSize;
+
     std::vector<VkBuffer> m_indirectBuffers;
     std::vector<VkDeviceMemory> m_indirectBuffersMemory;
 
@@ -82,6 +87,8 @@ private:
     // std::vector<DrawData> shapes;
     // MeshData m_meshData;
 
+    bool loadInstanceData(const char* drawDataFile);
+
     bool createDescriptorSet(VulkanRenderDevice& vkDev);
 
 };
\ No newline at end of file
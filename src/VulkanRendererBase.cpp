@@ -1,4 +1,5 @@
 #include "VulkanRendererBase.h"
+#include "VKShader.h"
 #include <stdio.h>
 
 
@@ -13,7 +14,7 @@ VulkanRendererBase::~VulkanRendererBase()
     {
         vkFreeMemory(*p_dev, mem, nullptr);
     }
-    if (m_descriptorSetLayout != VK_NULL_HANDLE)
+    if (m_descriptorSetLayout != VK_NULL_HANDLE && !m_bSharedDescriptorSetLayout)
     {
         vkDestroyDescriptorSetLayout(*p_dev, m_descriptorSetLayout, nullptr);
     }
@@ -78,3 +79,115 @@ bool VulkanRendererBase::createUniformBuffers(VulkanRenderDevice &vkDev, size_t
     }
     return true;
 }
+
+bool VulkanRendererBase::createDescriptorLayouts(VulkanRenderDevice &vkDev, const std::vector<const char *> &shaderFiles)
+{
+    ShaderReflection reflection;
+    return reflectShaderFiles(shaderFiles, reflection) && createDescriptorLayouts(vkDev, reflection);
+}
+
+bool VulkanRendererBase::createDescriptorLayouts(VulkanRenderDevice &vkDev, const std::vector<ShaderVariant> &shaders)
+{
+    ShaderReflection reflection;
+    return reflectShaderFiles(shaders, reflection) && createDescriptorLayouts(vkDev, reflection);
+}
+
+bool VulkanRendererBase::createDescriptorLayouts(VulkanRenderDevice &vkDev, const ShaderReflection &reflection)
+{
+    if(reflection.descriptorSets.empty())
+    {
+        printf("Shaders do not use any descriptor\n");
+        return false;
+    }
+
+    m_reflection = reflection;
+    m_descriptorSetLayout = getDescriptorSetLayout(vkDev.device, reflection.descriptorSets[0]);
+    m_bSharedDescriptorSetLayout = true;
+
+    return (m_descriptorSetLayout != VK_NULL_HANDLE) &&
+           createDescriptorPool(vkDev, reflection, &m_descriptorPool) &&
+           createPipelineLayout(vkDev.device, reflection, &m_pipelineLayout);
+}
+
+bool VulkanRendererBase::allocateDescriptorSets(VulkanRenderDevice &vkDev)
+{
+    std::vector<VkDescriptorSetLayout> layouts(vkDev.swapchainImages.size(), m_descriptorSetLayout);
+    const VkDescriptorSetAllocateInfo allocInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .pNext = nullptr,
+        .descriptorPool = m_descriptorPool,
+        .descriptorSetCount = static_cast<uint32_t>(layouts.size()),
+        .pSetLayouts = layouts.data()
+    };
+    m_descriptorSets.resize(vkDev.swapchainImages.size());
+
+    return (vkAllocateDescriptorSets(vkDev.device, &allocInfo, m_descriptorSets.data()) == VK_SUCCESS);
+}
+
+std::vector<std::string> VulkanRendererBase::getShaderFiles() const
+{
+    std::vector<std::string> files;
+    for(const ShaderVariant& shader : m_pipelineDesc.shaders)
+    {
+        files.push_back(shader.file);
+    }
+    return files;
+}
+
+bool VulkanRendererBase::createPipeline(VulkanRenderDevice &vkDev, const std::vector<const char *> &shaderFiles, VkPrimitiveTopology topology, bool useDepth, bool useBlending, bool dynamicScissorState, int32_t customWidth, int32_t customHeight, uint32_t numPatchControlPoints)
+{
+    return createPipeline(
+        vkDev, std::vector<ShaderVariant>(shaderFiles.begin(), shaderFiles.end()),
+        topology, useDepth, useBlending, dynamicScissorState, customWidth, customHeight, numPatchControlPoints);
+}
+
+bool VulkanRendererBase::createPipeline(VulkanRenderDevice &vkDev, const std::vector<ShaderVariant> &shaders, VkPrimitiveTopology topology, bool useDepth, bool useBlending, bool dynamicScissorState, int32_t customWidth, int32_t customHeight, uint32_t numPatchControlPoints)
+{
+    m_pipelineDesc = PipelineDesc
+    {
+        .shaders = shaders,
+        .topology = topology,
+        .useDepth = useDepth,
+        .useBlending = useBlending,
+        .dynamicScissorState = dynamicScissorState,
+        .customWidth = customWidth,
+        .customHeight = customHeight,
+        .numPatchControlPoints = numPatchControlPoints
+    };
+    return createGraphicsPipeline(
+        vkDev, m_renderPass, m_pipelineLayout, shaders, &m_graphicsPipeline,
+        topology, useDepth, useBlending, dynamicScissorState, customWidth, customHeight, numPatchControlPoints);
+}
+
+bool VulkanRendererBase::rebuildPipeline(VulkanRenderDevice &vkDev, VkPipeline *pipeline) const
+{
+    const PipelineDesc& d = m_pipelineDesc;
+    if(d.shaders.empty()) { return false; }
+
+    // compile first: pipeline creation treats a shader that does not compile as fatal
+    for(const ShaderVariant& shader : d.shaders)
+    {
+        ShaderModule module;
+        if(!compileShaderFile(shader.file.c_str(), module, shader.defines)) { return false; }
+    }
+
+    // the pipeline layout stays, so the edited shaders must not need bindings it does not have
+    ShaderReflection reflection;
+    if(m_bSharedDescriptorSetLayout &&
+       (!reflectShaderFiles(d.shaders, reflection) || !isLayoutCompatible(reflection, m_reflection)))
+    {
+        printf("The shaders no longer match the descriptor layout of '%s', restart to apply the change\n", d.shaders[0].file.c_str());
+        return false;
+    }
+
+    return createGraphicsPipeline(
+        vkDev, m_renderPass, m_pipelineLayout, d.shaders, pipeline,
+        d.topology, d.useDepth, d.useBlending, d.dynamicScissorState, d.customWidth, d.customHeight, d.numPatchControlPoints);
+}
+
+void VulkanRendererBase::replacePipeline(VkPipeline pipeline)
+{
+    vkDestroyPipeline(*p_dev, m_graphicsPipeline, nullptr);
+    m_graphicsPipeline = pipeline;
+}
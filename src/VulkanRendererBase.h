@@ -2,7 +2,10 @@
 
 #include <vulkan/vulkan.h>
 #include "VKUtils.h"
+#include "VKReflection.h"
+#include "VKShader.h"
 
+#include <string>
 #include <vector>
 
 
@@ -22,16 +25,64 @@ public:
 
     inline VulkanImage getDepthTexture() const { return m_depthTexture; }   
 
+    /* Shader files of the graphics pipeline, empty if it was not made by createPipeline() */
+    std::vector<std::string> getShaderFiles() const;
+
+    /**
+     * Builds a new pipeline like the current one from the current shader sources; the current pipeline is untouched.
+     * Safe on any thread. False if a shader does not compile.
+     */
+    bool rebuildPipeline(VulkanRenderDevice& vkDev, VkPipeline* pipeline) const;
+
+    /* Destroys the current pipeline and uses 'pipeline' from now on; only between frames, when no work uses it */
+    void replacePipeline(VkPipeline pipeline);
+
 protected:
 
     void beginRenderPass(VkCommandBuffer commandBuffer, size_t currentImage);
     bool createUniformBuffers(VulkanRenderDevice& vkDev, size_t uniformDataSize);
 
+    /**
+     * Descriptor pool (one copy of every set per swapchain image) and pipeline layout for the resources the shaders
+     * declare. m_descriptorSetLayout becomes the shared layout of set 0 and is not destroyed with the renderer.
+     */
+    bool createDescriptorLayouts(VulkanRenderDevice& vkDev, const std::vector<const char*>& shaderFiles);
+    bool createDescriptorLayouts(VulkanRenderDevice& vkDev, const std::vector<ShaderVariant>& shaders);
+    bool createDescriptorLayouts(VulkanRenderDevice& vkDev, const ShaderReflection& reflection);
+
+    /* One set 0 per swapchain image, from m_descriptorPool */
+    bool allocateDescriptorSets(VulkanRenderDevice& vkDev);
+
+    /* createGraphicsPipeline() for m_renderPass and m_pipelineLayout, remembering its arguments for rebuildPipeline() */
+    bool createPipeline(
+        VulkanRenderDevice& vkDev,
+        const std::vector<const char*>& shaderFiles,
+        VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        bool useDepth = true,
+        bool useBlending = true,
+        bool dynamicScissorState = false,
+        int32_t customWidth = -1,
+        int32_t customHeight = -1,
+        uint32_t numPatchControlPoints = 0);
+    bool createPipeline(
+        VulkanRenderDevice& vkDev,
+        const std::vector<ShaderVariant>& shaders,
+        VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        bool useDepth = true,
+        bool useBlending = true,
+        bool dynamicScissorState = false,
+        int32_t customWidth = -1,
+        int32_t customHeight = -1,
+        uint32_t numPatchControlPoints = 0);
+
     uint32_t* p_framebufferWidth = nullptr;
     uint32_t* p_framebufferHeight = nullptr;
     VkDevice* p_dev = nullptr;
 
     VkDescriptorSetLayout m_descriptorSetLayout = nullptr;
+    bool m_bSharedDescriptorSetLayout = false;
+    // what the pipeline layout was made from, when it came from createDescriptorLayouts()
+    ShaderReflection m_reflection;
     VkDescriptorPool m_descriptorPool = nullptr;
     std::vector<VkDescriptorSet> m_descriptorSets;
 
@@ -43,6 +94,19 @@ protected:
     VkPipelineLayout m_pipelineLayout = nullptr;
     VkPipeline m_graphicsPipeline = nullptr;
 
+    struct PipelineDesc
+    {
+        std::vector<ShaderVariant> shaders;
+        VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        bool useDepth = true;
+        bool useBlending = true;
+        bool dynamicScissorState = false;
+        int32_t customWidth = -1;
+        int32_t customHeight = -1;
+        uint32_t numPatchControlPoints = 0;
+    };
+    PipelineDesc m_pipelineDesc;
+
     std::vector<VkBuffer> m_uniformBuffers;
     std::vector<VkDeviceMemory> m_uniformBuffersMemory;
 };
\ No newline at end of file
@@ -7,7 +7,9 @@
 
 // #include <volk/volk.h>
 #include <imgui/imgui.h>
+#if !BUILD_WITH_EMBEDDED_SHADERS
 #include <glslang/Include/glslang_c_interface.h>
+#endif
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -30,7 +32,9 @@ int main()
     // EASY_PROFILER_ENABLE;
     // EASY_MAIN_THREAD;
 
+#if !BUILD_WITH_EMBEDDED_SHADERS
     glslang_initialize_process();
+#endif
 
     // volkInitialize();
 
@@ -151,7 +155,9 @@ int main()
 
     terminateVulkan();
     glfwTerminate();
+#if !BUILD_WITH_EMBEDDED_SHADERS
     glslang_finalize_process();
+#endif
 
     // PROFILER_DUMP("profiling.prof");
 
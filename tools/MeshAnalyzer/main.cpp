@@ -0,0 +1,306 @@
+/**
+ * Mesh file analyzer.
+ *
+ *   MeshAnalyzer <file.mesh> [options]
+ *
+ * Prints GPU cost metrics of every mesh LOD in a converted mesh file:
+ *  - post-transform cache: ACMR (transformed vertices per triangle) and ATVR (transformed vertices per
+ *    referenced vertex) of a FIFO cache for each --cache size (meshopt_analyzeVertexCache),
+ *  - overdraw: shaded / covered pixels of the software rasterizer in meshopt_analyzeOverdraw,
+ *  - vertex fetch: bytes pulled through 64-byte cache lines in index order over the bytes of the referenced vertices,
+ *    summed over all vertex streams (meshopt_analyzeVertexFetch),
+ *  - bytes per triangle: index bytes of the LOD plus the encoded size of the vertices it references,
+ *  - duplicate vertices: vertices of the mesh whose encoded bytes equal those of another vertex in every stream.
+ *
+ * With any --max-* threshold the analyzer exits with a failure when a mesh LOD exceeds it, so asset
+ * submissions can be gated on it.
+ */
+#include "VtxData.h"
+#include "UtilsThreadPool.h"
+
+#include <meshoptimizer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static void printUsage()
+{
+    printf(
+        "Usage: MeshAnalyzer <file.mesh> [options]\n"
+        "  --cache <n>[,<n>...]          post-transform cache sizes (default: 16,32)\n"
+        "  --lod0                        analyze LOD 0 only\n"
+        "  --max-acmr <x>                fail when ACMR at the first cache size exceeds x\n"
+        "  --max-overdraw <x>            fail when overdraw exceeds x\n"
+        "  --max-overfetch <x>           fail when vertex fetch overfetch exceeds x\n"
+        "  --max-bytes-per-triangle <x>  fail when bytes per triangle exceed x\n"
+        "  --max-duplicates <n>          fail when a mesh has more than n duplicate vertices\n");
+}
+
+struct CacheResult
+{
+    float acmr;
+    float atvr;
+};
+
+struct LODResult
+{
+    uint32_t triangles = 0;
+    uint32_t vertices = 0;
+    /* false if an index is past the vertices of the mesh, nothing else is analyzed then */
+    bool bValidIndices = true;
+    std::vector<CacheResult> cache;
+    float overdraw = 0.0f;
+    float overfetch = 0.0f;
+    float bytesPerTriangle = 0.0f;
+};
+
+struct MeshResult
+{
+    uint32_t duplicateVertices = 0;
+    std::vector<LODResult> lods;
+};
+
+struct Thresholds
+{
+    float maxACMR = 0.0f;
+    float maxOverdraw = 0.0f;
+    float maxOverfetch = 0.0f;
+    float maxBytesPerTriangle = 0.0f;
+    int64_t maxDuplicates = -1;
+};
+
+static std::vector<uint32_t> readLODIndices(const MeshFileView& view, const Mesh& mesh, uint32_t lod)
+{
+    std::vector<uint32_t> indices(mesh.getLODSize(lod) / mesh.indexSize);
+    const uint8_t* src = view.indexData.data() + mesh.lodOffset[lod];
+    for(size_t i = 0; i != indices.size(); i++)
+    {
+        if(mesh.indexSize == sizeof(uint16_t))
+        {
+            uint16_t idx;
+            memcpy(&idx, src + i * sizeof(uint16_t), sizeof(idx));
+            indices[i] = idx;
+        }
+        else
+        {
+            memcpy(&indices[i], src + i * sizeof(uint32_t), sizeof(uint32_t));
+        }
+    }
+    return indices;
+}
+
+static uint32_t countDuplicateVertices(const MeshFileView& view, const Mesh& mesh)
+{
+    if(!mesh.vertexCount) { return 0; }
+
+    meshopt_Stream streams[kMaxStreams];
+    for(uint32_t s = 0; s != mesh.streamCount; s++)
+    {
+        streams[s] = meshopt_Stream{ view.vertexData.data() + mesh.streamOffset[s], mesh.streamElementSize[s], mesh.streamElementSize[s] };
+    }
+    std::vector<unsigned int> remap(mesh.vertexCount);
+    const size_t uniqueVertices = meshopt_generateVertexRemapMulti(remap.data(), nullptr, mesh.vertexCount, mesh.vertexCount, streams, mesh.streamCount);
+    return mesh.vertexCount - static_cast<uint32_t>(uniqueVertices);
+}
+
+static LODResult analyzeLOD(const MeshFileView& view, const Mesh& mesh, uint32_t lod, const std::vector<uint32_t>& cacheSizes,
+    const std::vector<float>& positions)
+{
+    LODResult result;
+    const std::vector<uint32_t> indices = readLODIndices(view, mesh, lod);
+    result.triangles = static_cast<uint32_t>(indices.size() / 3);
+
+    std::vector<uint8_t> referenced(mesh.vertexCount, 0);
+    for(uint32_t idx : indices)
+    {
+        if(idx >= mesh.vertexCount)
+        {
+            result.bValidIndices = false;
+            return result;
+        }
+        result.vertices += referenced[idx] ? 0 : 1;
+        referenced[idx] = 1;
+    }
+
+    for(uint32_t cacheSize : cacheSizes)
+    {
+        const meshopt_VertexCacheStatistics vcs = meshopt_analyzeVertexCache(indices.data(), indices.size(), mesh.vertexCount, cacheSize, 0, 0);
+        result.cache.push_back(CacheResult{ .acmr = vcs.acmr, .atvr = vcs.atvr });
+    }
+
+    result.overdraw = meshopt_analyzeOverdraw(indices.data(), indices.size(), positions.data(), mesh.vertexCount, sizeof(float) * 3).overdraw;
+
+    uint64_t bytesFetched = 0;
+    uint64_t vertexBytes = 0;
+    for(uint32_t s = 0; s != mesh.streamCount; s++)
+    {
+        bytesFetched += meshopt_analyzeVertexFetch(indices.data(), indices.size(), mesh.vertexCount, mesh.streamElementSize[s]).bytes_fetched;
+        vertexBytes += uint64_t(result.vertices) * mesh.streamElementSize[s];
+    }
+    result.overfetch = vertexBytes ? float(double(bytesFetched) / double(vertexBytes)) : 0.0f;
+
+    result.bytesPerTriangle = result.triangles ? float(double(mesh.getLODSize(lod) + vertexBytes) / double(result.triangles)) : 0.0f;
+    return result;
+}
+
+static MeshResult analyzeMesh(const MeshFileView& view, const Mesh& mesh, const std::vector<uint32_t>& cacheSizes, bool bLOD0Only)
+{
+    MeshResult result;
+    result.duplicateVertices = countDuplicateVertices(view, mesh);
+
+    // the overdraw rasterizer wants float positions, whatever the encoding in the file
+    std::vector<float> positions(size_t(mesh.vertexCount) * 3);
+    const uint8_t* vertices = view.vertexData.data() + mesh.streamOffset[0];
+    for(uint32_t i = 0; i != mesh.vertexCount; i++)
+    {
+        const glm::vec3 p = decodeVertexPosition(mesh.vertexFormat, vertices + size_t(i) * mesh.streamElementSize[0]);
+        memcpy(&positions[size_t(i) * 3], &p, sizeof(float) * 3);
+    }
+
+    const uint32_t lodCount = bLOD0Only ? 1 : mesh.lodCount;
+    for(uint32_t lod = 0; lod != lodCount; lod++)
+    {
+        result.lods.push_back(analyzeLOD(view, mesh, lod, cacheSizes, positions));
+    }
+    return result;
+}
+
+/* Prints the exceeded thresholds of one LOD, false if there are any */
+static bool checkThresholds(const MeshResult& mesh, const LODResult& lod, const Thresholds& t)
+{
+    bool bPassed = true;
+    auto check = [&](bool bExceeded, const char* name, double value)
+    {
+        if(!bExceeded) { return; }
+        printf("      exceeds --max-%s: %.3f\n", name, value);
+        bPassed = false;
+    };
+    check(t.maxACMR > 0.0f && !lod.cache.empty() && lod.cache[0].acmr > t.maxACMR, "acmr", lod.cache.empty() ? 0.0 : lod.cache[0].acmr);
+    check(t.maxOverdraw > 0.0f && lod.overdraw > t.maxOverdraw, "overdraw", lod.overdraw);
+    check(t.maxOverfetch > 0.0f && lod.overfetch > t.maxOverfetch, "overfetch", lod.overfetch);
+    check(t.maxBytesPerTriangle > 0.0f && lod.bytesPerTriangle > t.maxBytesPerTriangle, "bytes-per-triangle", lod.bytesPerTriangle);
+    check(t.maxDuplicates >= 0 && mesh.duplicateVertices > t.maxDuplicates, "duplicates", mesh.duplicateVertices);
+    return bPassed;
+}
+
+static bool parseCacheSizes(const char* arg, std::vector<uint32_t>& cacheSizes)
+{
+    cacheSizes.clear();
+    for(const char* p = arg; *p; )
+    {
+        char* end = nullptr;
+        const long size = strtol(p, &end, 10);
+        if(end == p || size <= 0) { return false; }
+        if(*end && *end != ',') { return false; }
+        cacheSizes.push_back(static_cast<uint32_t>(size));
+        p = *end ? end + 1 : end;
+    }
+    return !cacheSizes.empty();
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<uint32_t> cacheSizes = { 16, 32 };
+    Thresholds thresholds;
+    bool bLOD0Only = false;
+
+    for(int i = 2; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if(!strcmp(arg, "--cache") && i + 1 < argc)
+        {
+            if(!parseCacheSizes(argv[++i], cacheSizes))
+            {
+                printf("Invalid cache sizes '%s'\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(!strcmp(arg, "--lod0"))                                     { bLOD0Only = true; }
+        else if(!strcmp(arg, "--max-acmr") && i + 1 < argc)                 { thresholds.maxACMR = float(atof(argv[++i])); }
+        else if(!strcmp(arg, "--max-overdraw") && i + 1 < argc)             { thresholds.maxOverdraw = float(atof(argv[++i])); }
+        else if(!strcmp(arg, "--max-overfetch") && i + 1 < argc)            { thresholds.maxOverfetch = float(atof(argv[++i])); }
+        else if(!strcmp(arg, "--max-bytes-per-triangle") && i + 1 < argc)   { thresholds.maxBytesPerTriangle = float(atof(argv[++i])); }
+        else if(!strcmp(arg, "--max-duplicates") && i + 1 < argc)           { thresholds.maxDuplicates = atoll(argv[++i]); }
+        else
+        {
+            printf("Unknown option '%s'\n", arg);
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the rasterizer in meshopt_analyzeOverdraw dominates, meshes are analyzed on all cores
+    ThreadPool pool;
+    MeshFileView view;
+    if(!mapMeshFile(argv[1], view, true, &pool))
+    {
+        printf("Cannot read mesh file '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<MeshResult> results(view.meshes.size());
+    pool.parallelFor(view.meshes.size(), [&](size_t i)
+    {
+        results[i] = analyzeMesh(view, view.meshes[i], cacheSizes, bLOD0Only);
+    });
+
+    printf("%6s %4s %10s %10s", "mesh", "lod", "triangles", "vertices");
+    for(uint32_t cacheSize : cacheSizes)
+    {
+        char acmr[32], atvr[32];
+        snprintf(acmr, sizeof(acmr), "ACMR@%u", cacheSize);
+        snprintf(atvr, sizeof(atvr), "ATVR@%u", cacheSize);
+        printf(" %9s %9s", acmr, atvr);
+    }
+    printf(" %9s %9s %9s %10s\n", "overdraw", "overfetch", "B/tri", "duplicates");
+
+    uint32_t numFailed = 0;
+    uint64_t totalTriangles = 0;
+    double totalBytes = 0.0;
+    for(size_t i = 0; i != results.size(); i++)
+    {
+        const MeshResult& mesh = results[i];
+        for(size_t lod = 0; lod != mesh.lods.size(); lod++)
+        {
+            const LODResult& r = mesh.lods[lod];
+            if(!r.bValidIndices)
+            {
+                printf("%6zu %4zu %10u   indices out of range\n", i, lod, r.triangles);
+                numFailed++;
+                continue;
+            }
+            printf("%6zu %4zu %10u %10u", i, lod, r.triangles, r.vertices);
+            for(const CacheResult& c : r.cache)
+            {
+                printf(" %9.3f %9.3f", c.acmr, c.atvr);
+            }
+            printf(" %9.3f %9.3f %9.2f %10u\n", r.overdraw, r.overfetch, r.bytesPerTriangle, mesh.duplicateVertices);
+
+            numFailed += checkThresholds(mesh, r, thresholds) ? 0 : 1;
+            if(lod == 0)
+            {
+                totalTriangles += r.triangles;
+                totalBytes += double(r.bytesPerTriangle) * r.triangles;
+            }
+        }
+    }
+
+    printf("%zu meshes, %llu LOD 0 triangles, %.2f bytes per LOD 0 triangle\n",
+        results.size(), static_cast<unsigned long long>(totalTriangles), totalTriangles ? totalBytes / double(totalTriangles) : 0.0);
+    unmapMeshFile(view);
+
+    if(numFailed)
+    {
+        printf("%u mesh LODs are invalid or exceed the thresholds\n", numFailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+/**
+ * Batch mesh converter.
+ *
+ *   MeshConverter <input dir> <output dir> [options]
+ *
+ * Converts every supported asset below <input dir> into <output dir>/<relative path>.mesh.
+ * An output is reused when its header carries the same source key (hash of the asset contents
+ * and the converter options), so repeated runs only convert what changed.
+ *
+ * With --combine <name> all assets go into <output dir>/<name>.mesh instead, plus <name>.instances with
+ * one InstanceData per placed mesh, sorted into material batches; add --dedup to store props shared by several
+ * assets once and --instances to keep node transforms instead of baking them into the vertices.
+ */
+#include "MeshConvert.h"
+#include "UtilsThreadPool.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static const char* kSupportedExtensions[] = { ".obj", ".gltf", ".glb", ".fbx" };
+
+static void printUsage()
+{
+    printf(
+        "Usage: MeshConverter <input dir> <output dir> [options]\n"
+        "  -j <threads>        worker threads (default: all cores)\n"
+        "  --textures          export texture coordinates\n"
+        "  --normals           export normals\n"
+        "  --optimize          vertex cache, overdraw and vertex fetch optimization\n"
+        "  --lods              generate LOD chains\n"
+        "  --quantize          16-bit positions and texture coordinates, octahedral normals\n"
+        "  --split-streams     store positions in a stream of their own (depth-only friendly)\n"
+        "  --compress-indices  store the index block with the meshoptimizer index codec\n"
+        "  --compress-vertices store the vertex block with the meshoptimizer vertex codec\n"
+        "  --meshlets          generate meshlets with culling bounds\n"
+        "  --stream            write meshes as they are converted, keeping memory use bounded\n"
+        "  --instances         keep node transforms as instances instead of pre-transforming vertices\n"
+        "  --dedup             store meshes with identical geometry once\n"
+        "  --combine <name>    convert everything into <name>.mesh and <name>.instances\n"
+        "  --assimp            import glTF files with assimp instead of the glTF fast path\n"
+        "  --force             ignore cached outputs\n"
+        "  --verbose           print converter details\n");
+}
+
+static bool isSupportedAsset(const fs::path& path)
+{
+    std::string ext = path.extension().string();
+    for(char& c : ext) { c = static_cast<char>(tolower(c)); }
+
+    for(const char* supported : kSupportedExtensions)
+    {
+        if(ext == supported) { return true; }
+    }
+    return false;
+}
+
+struct FileResult
+{
+    bool converted = false;
+    bool failed = false;
+    uint64_t srcSize = 0;
+    uint64_t dstSize = 0;
+    double milliseconds = 0.0;
+};
+
+/* Converts all jobs into one mesh file, in order, so deduplication works across assets */
+static int convertCombined(const std::vector<MeshConvertJob>& jobs, const fs::path& outputDir, const std::string& name,
+    const MeshConvertOptions& options, ThreadPool& pool)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    MeshConverter converter(options, &pool);
+    uint32_t numFailed = 0;
+    for(const MeshConvertJob& job : jobs)
+    {
+        if(!converter.loadFile(job.srcFile.c_str()))
+        {
+            printf("FAILED    %s\n", job.srcFile.c_str());
+            numFailed++;
+        }
+    }
+
+    std::error_code ec;
+    fs::create_directories(outputDir, ec);
+    const std::string meshFile = (outputDir / (name + ".mesh")).string();
+    const std::string instanceFile = (outputDir / (name + ".instances")).string();
+    // both files are replaced together, a failure keeps the previous pair
+    const bool bWritten = converter.saveMeshData((meshFile + ".tmp").c_str()) && converter.saveInstanceData((instanceFile + ".tmp").c_str());
+    const std::vector<std::string> files = { instanceFile, meshFile };
+    if(!replaceConvertedFiles(files, bWritten))
+    {
+        return EXIT_FAILURE;
+    }
+
+    const MeshData& m = converter.getMeshData();
+    printf("%zu source meshes -> %zu meshes, %.2f MiB vertices, %.2f MiB indices in %.2f s\n",
+        m.instances.size(), m.meshes.size(),
+        double(m.vertexData.size()) / (1024.0 * 1024.0), double(m.indexData.size()) / (1024.0 * 1024.0),
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+    printf("Wrote '%s' and '%s'\n", meshFile.c_str(), instanceFile.c_str());
+
+    return numFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    const fs::path inputDir = argv[1];
+    const fs::path outputDir = argv[2];
+
+    MeshConvertOptions options;
+    options.verbose = false;
+    uint32_t numThreads = std::thread::hardware_concurrency();
+    bool bForce = false;
+    std::string combineName;
+
+    for(int i = 3; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if(!strcmp(arg, "-j") && i + 1 < argc)   { numThreads = static_cast<uint32_t>(atoi(argv[++i])); }
+        else if(!strcmp(arg, "--textures"))      { options.exportTextures = true; }
+        else if(!strcmp(arg, "--normals"))       { options.exportNormals = true; }
+        else if(!strcmp(arg, "--optimize"))      { options.optimize = true; }
+        else if(!strcmp(arg, "--lods"))          { options.calculateLODs = true; }
+        else if(!strcmp(arg, "--quantize"))      { options.setQuantized(); }
+        else if(!strcmp(arg, "--split-streams")) { options.vertexLayout = eVertexLayout_Split; }
+        else if(!strcmp(arg, "--compress-indices")) { options.indexCodec = eIndexCodec_Meshopt; }
+        else if(!strcmp(arg, "--compress-vertices")) { options.vertexCodec = eVertexCodec_Meshopt; }
+        else if(!strcmp(arg, "--meshlets"))      { options.generateMeshlets = true; }
+        else if(!strcmp(arg, "--stream"))        { options.streaming = true; }
+        else if(!strcmp(arg, "--instances"))     { options.keepInstances = true; }
+        else if(!strcmp(arg, "--dedup"))         { options.deduplicate = true; }
+        else if(!strcmp(arg, "--combine") && i + 1 < argc) { combineName = argv[++i]; }
+        else if(!strcmp(arg, "--assimp"))        { options.gltfFastPath = false; }
+        else if(!strcmp(arg, "--force"))         { bForce = true; }
+        else if(!strcmp(arg, "--verbose"))       { options.verbose = true; }
+        else
+        {
+            printf("Unknown option '%s'\n", arg);
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::error_code ec;
+    if(!fs::is_directory(inputDir, ec))
+    {
+        printf("'%s' is not a directory\n", inputDir.string().c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::vector<MeshConvertJob> jobs;
+    for(const fs::directory_entry& entry : fs::recursive_directory_iterator(inputDir, ec))
+    {
+        if(!entry.is_regular_file() || !isSupportedAsset(entry.path())) { continue; }
+
+        fs::path dst = outputDir / fs::relative(entry.path(), inputDir);
+        dst += ".mesh";
+        jobs.push_back(MeshConvertJob{ .srcFile = entry.path().string(), .meshFile = dst.string() });
+    }
+
+    // directory iteration order is unspecified; a fixed order keeps combined outputs reproducible
+    std::sort(jobs.begin(), jobs.end(), [](const MeshConvertJob& a, const MeshConvertJob& b) { return a.srcFile < b.srcFile; });
+
+    printf("%zu assets in '%s'\n", jobs.size(), inputDir.string().c_str());
+
+    ThreadPool pool(numThreads);
+
+    if(!combineName.empty())
+    {
+        return convertCombined(jobs, outputDir, combineName, options, pool);
+    }
+
+    std::vector<FileResult> results(jobs.size());
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    pool.parallelFor(jobs.size(), [&](size_t i)
+    {
+        const MeshConvertJob& job = jobs[i];
+        FileResult& result = results[i];
+        const auto fileStart = std::chrono::steady_clock::now();
+
+        std::error_code ec;
+        result.srcSize = fs::file_size(job.srcFile, ec);
+
+        const uint64_t sourceKey = meshConvertSourceKey(job.srcFile.c_str(), options);
+        MeshFileHeader header;
+        if(!bForce && sourceKey && readMeshFileHeader(job.meshFile.c_str(), header) && header.sourceKey == sourceKey)
+        {
+            result.dstSize = fs::file_size(job.meshFile, ec);
+            return;
+        }
+
+        fs::create_directories(fs::path(job.meshFile).parent_path(), ec);
+
+        result.converted = true;
+        result.failed = !sourceKey || !convertMeshFile(job.srcFile.c_str(), job.meshFile.c_str(), options, &pool, sourceKey);
+        result.dstSize = result.failed ? 0 : fs::file_size(job.meshFile, ec);
+        result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - fileStart).count();
+
+        if(result.failed)
+        {
+            printf("FAILED    %s\n", job.srcFile.c_str());
+        }
+        else
+        {
+            printf("converted %s: %.1f ms, %.1f KiB -> %.1f KiB\n",
+                job.srcFile.c_str(), result.milliseconds,
+                double(result.srcSize) / 1024.0, double(result.dstSize) / 1024.0);
+        }
+    });
+
+    const double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    uint32_t numConverted = 0, numCached = 0, numFailed = 0;
+    uint64_t srcBytes = 0, dstBytes = 0;
+    double convertMilliseconds = 0.0;
+    for(const FileResult& result : results)
+    {
+        if(result.failed) { numFailed++; continue; }
+        if(result.converted) { numConverted++; convertMilliseconds += result.milliseconds; }
+        else { numCached++; }
+        srcBytes += result.srcSize;
+        dstBytes += result.dstSize;
+    }
+
+    printf("%u converted, %u cached, %u failed in %.2f s (%.2f s of conversion work on %u threads)\n",
+        numConverted, numCached, numFailed, totalSeconds, convertMilliseconds / 1000.0, pool.getNumThreads());
+    printf("Sources %.2f MiB, outputs %.2f MiB\n", double(srcBytes) / (1024.0 * 1024.0), double(dstBytes) / (1024.0 * 1024.0));
+
+    return numFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+/**
+ * Build-time shader compiler.
+ *
+ *   ShaderCompiler [--optimize=performance|size] <output.inl> <shader>[:DEFINE,NAME=VALUE...]...
+ *
+ * Compiles every shader with the compileShader() the application uses and writes the SPIR-V, together with the
+ * descriptor bindings and push constants reflectSPIRV() finds in it, as constexpr arrays: the kEmbeddedShaders[]
+ * table that VKShader.cpp includes in BUILD_WITH_EMBEDDED_SHADERS builds.
+ *
+ * Shader names are stored as given and the application looks them up by the names it loads them with, so run it from
+ * the directory those names are relative to. A variant with defines is only found if it is listed with the same
+ * defines here. Any shader that does not compile fails the build. --optimize runs the SPIRV-Tools recipe on every shader
+ * and reports what it did, it needs a build with BUILD_WITH_SPIRV_OPT.
+ */
+#include "VKShader.h"
+#include "VKReflection.h"
+#include "UtilsThreadPool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+static void printUsage()
+{
+    printf("Usage: ShaderCompiler [--optimize=performance|size] <output.inl> <shader>[:DEFINE,NAME=VALUE...]...\n");
+}
+
+/* "shaders/VK02.frag:TEXTURED,X=2" */
+static ShaderVariant parseVariant(const char* arg)
+{
+    const std::string s(arg);
+    const size_t colon = s.find(':');
+    ShaderVariant variant(s.substr(0, colon).c_str());
+    for(size_t begin = colon; begin != s.npos; )
+    {
+        const size_t end = s.find(',', begin + 1);
+        const std::string define = s.substr(begin + 1, end == s.npos ? s.npos : end - begin - 1);
+        if(!define.empty()) { variant.defines.push_back(define); }
+        begin = end;
+    }
+    return variant;
+}
+
+/* The SPIR-V of one shader and its bindings, flattened, as kSpirv<index> and kBindings<index> */
+static void writeShader(FILE* out, size_t index, const std::string& fileName, const std::vector<unsigned int>& spirv, const ShaderReflection& reflection)
+{
+    fprintf(out, "// %s\nstatic constexpr unsigned int kSpirv%zu[] =\n{", fileName.c_str(), index);
+    for(size_t i = 0; i != spirv.size(); i++)
+    {
+        fprintf(out, "%s0x%08x,", (i % 8) ? " " : "\n    ", spirv[i]);
+    }
+    fprintf(out, "\n};\n");
+
+    size_t bindingCount = 0;
+    for(const std::vector<VkDescriptorSetLayoutBinding>& set : reflection.descriptorSets) { bindingCount += set.size(); }
+    if(bindingCount)
+    {
+        fprintf(out, "static constexpr EmbeddedBinding kBindings%zu[] =\n{\n", index);
+        for(size_t set = 0; set != reflection.descriptorSets.size(); set++)
+        {
+            for(const VkDescriptorSetLayoutBinding& b : reflection.descriptorSets[set])
+            {
+                fprintf(out, "    { %zu, %u, static_cast<VkDescriptorType>(%d), %u },\n", set, b.binding, static_cast<int>(b.descriptorType), b.descriptorCount);
+            }
+        }
+        fprintf(out, "};\n");
+    }
+    fprintf(out, "\n");
+}
+
+int main(int argc, char** argv)
+{
+    ShaderOptimization optimization = ShaderOptimization::None;
+    if(argc > 1 && !strncmp(argv[1], "--optimize=", 11))
+    {
+        if(!strcmp(argv[1] + 11, "performance")) { optimization = ShaderOptimization::Performance; }
+        else if(!strcmp(argv[1] + 11, "size")) { optimization = ShaderOptimization::Size; }
+        else
+        {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+        argv++;
+        argc--;
+    }
+    if(argc < 3)
+    {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    // every input is compiled exactly once, a disk cache would only litter the source tree
+    setShaderCacheDirectory("");
+    setShaderOptimization(optimization);
+
+    const std::vector<const char*> args(argv + 2, argv + argc);
+    std::vector<ShaderVariant> shaders;
+    for(const char* arg : args) { shaders.push_back(parseVariant(arg)); }
+
+    bool bResult = true;
+    {
+        ThreadPool pool;
+        const std::vector<std::shared_future<size_t>> results = compileShaderFilesAsync(pool, shaders);
+        for(size_t i = 0; i != results.size(); i++)
+        {
+            if(!results[i].get())
+            {
+                printf("ShaderCompiler: '%s' failed\n", args[i]);
+                bResult = false;
+            }
+        }
+    }
+    if(!bResult) { return EXIT_FAILURE; }
+
+    FILE* out = fopen(argv[1], "wb");
+    if(!out)
+    {
+        printf("Cannot write '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    fprintf(out, "// Generated by tools/ShaderCompiler, do not edit\n\n");
+
+    std::vector<std::string> names;
+    std::vector<std::string> defines;
+    std::vector<VkShaderStageFlagBits> stages;
+    std::vector<ShaderReflection> reflections;
+
+    for(size_t i = 0; i != shaders.size() && bResult; i++)
+    {
+        const char* file = shaders[i].file.c_str();
+        names.push_back(std::filesystem::path(file).lexically_normal().generic_string());
+        defines.push_back(shaderDefinesKey(shaders[i].defines));
+        stages.push_back(getVkShaderStageFromFileName(file));
+
+        // served from the in-memory cache the batch above filled
+        ShaderModule module;
+        reflections.emplace_back();
+        bResult = compileShaderFile(file, module, shaders[i].defines) &&
+                  reflectSPIRV(module.SPIRV.data(), module.SPIRV.size(), stages[i], reflections[i]);
+        if(bResult) { writeShader(out, i, args[i], module.SPIRV, reflections[i]); }
+        else { printf("ShaderCompiler: '%s' failed\n", args[i]); }
+    }
+
+    if(bResult)
+    {
+        fprintf(out, "static constexpr EmbeddedShader kEmbeddedShaders[] =\n{\n");
+        for(size_t i = 0; i != shaders.size(); i++)
+        {
+            bool bBindings = false;
+            for(const std::vector<VkDescriptorSetLayoutBinding>& set : reflections[i].descriptorSets) { bBindings = bBindings || !set.empty(); }
+
+            // a single stage has at most one push constant range
+            const VkPushConstantRange pc = reflections[i].pushConstantRanges.empty() ? VkPushConstantRange{} : reflections[i].pushConstantRanges[0];
+            fprintf(out, "    { \"%s\", \"%s\", static_cast<VkShaderStageFlagBits>(%u), kSpirv%zu, sizeof(kSpirv%zu) / sizeof(unsigned int), ",
+                names[i].c_str(), defines[i].c_str(), static_cast<uint32_t>(stages[i]), i, i);
+            if(bBindings) { fprintf(out, "kBindings%zu, sizeof(kBindings%zu) / sizeof(EmbeddedBinding), ", i, i); }
+            else { fprintf(out, "nullptr, 0, "); }
+            fprintf(out, "{ %u, %u, %u } },\n", pc.stageFlags, pc.offset, pc.size);
+        }
+        fprintf(out, "};\n");
+    }
+
+    bResult = (fclose(out) == 0) && bResult;
+    if(!bResult)
+    {
+        std::error_code ec;
+        std::filesystem::remove(argv[1], ec);
+        return EXIT_FAILURE;
+    }
+
+    printf("ShaderCompiler: %zu shaders written to '%s'\n", shaders.size(), argv[1]);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,201 @@
+/**
+ * Vertex stream layout benchmark.
+ *
+ *   VertexLayoutBench <asset> [options]
+ *
+ * Converts <asset> with interleaved and with split vertex streams and compares a depth-only pass
+ * (positions) against a full pass (positions, texCoords, normals) under each layout:
+ *  - vertex fetch: bytes the GPU pulls through 64-byte cache lines in index order (meshopt_analyzeVertexFetch),
+ *  - pulling time: the vertex pulling of VK02.vert replayed on the CPU with the same address math.
+ */
+#include "MeshConvert.h"
+#include "UtilsThreadPool.h"
+
+#include <meshoptimizer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+static void printUsage()
+{
+    printf(
+        "Usage: VertexLayoutBench <asset> [options]\n"
+        "  --quantize          16-bit positions and texture coordinates, octahedral normals\n"
+        "  --optimize          vertex cache, overdraw and vertex fetch optimization\n"
+        "  --iterations <n>    repetitions of every timed pass (default: 20)\n");
+}
+
+enum ePass
+{
+    ePass_Depth = 0,
+    ePass_Full,
+    ePass_Count
+};
+
+static const char* kPassNames[ePass_Count] = { "depth-only", "full" };
+static const char* kLayoutNames[] = { "interleaved", "split" };
+
+struct PassResult
+{
+    uint64_t bytesFetched = 0;
+    uint64_t vertexInvocations = 0;
+    double milliseconds = 0.0;
+};
+
+static std::vector<uint32_t> readLOD0Indices(const MeshData& m, const Mesh& mesh)
+{
+    std::vector<uint32_t> indices(mesh.getLODSize(0) / mesh.indexSize);
+    const uint8_t* src = m.indexData.data() + mesh.lodOffset[0];
+    for(size_t i = 0; i != indices.size(); i++)
+    {
+        if(mesh.indexSize == sizeof(uint16_t))
+        {
+            uint16_t idx;
+            memcpy(&idx, src + i * sizeof(uint16_t), sizeof(idx));
+            indices[i] = idx;
+        }
+        else
+        {
+            memcpy(&indices[i], src + i * sizeof(uint32_t), sizeof(uint32_t));
+        }
+    }
+    return indices;
+}
+
+/* Words a vertex shader reads per vertex from the position stream and from the attribute stream */
+static void pulledWords(const VertexFormat& fmt, ePass pass, uint32_t& positionWords, uint32_t& attributeWords)
+{
+    positionWords = vertexAttributeSize(fmt.position, 3) / sizeof(uint32_t);
+    attributeWords = (pass == ePass_Full) ?
+        (vertexAttributeSize(fmt.texCoord, 2) + vertexAttributeSize(fmt.normal, 3)) / sizeof(uint32_t) : 0;
+}
+
+static PassResult runPass(const MeshData& m, ePass pass, uint32_t iterations)
+{
+    PassResult result;
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(m.vertexData.data());
+    uint32_t sink = 0;
+
+    std::vector<std::vector<uint32_t>> meshIndices;
+    meshIndices.reserve(m.meshes.size());
+    for(const Mesh& mesh : m.meshes)
+    {
+        meshIndices.push_back(readLOD0Indices(m, mesh));
+
+        uint32_t positionWords, attributeWords;
+        pulledWords(mesh.vertexFormat, pass, positionWords, attributeWords);
+        const std::vector<uint32_t>& indices = meshIndices.back();
+
+        if(vertexFormatStreamCount(mesh.vertexFormat) == 2)
+        {
+            result.bytesFetched += meshopt_analyzeVertexFetch(indices.data(), indices.size(), mesh.vertexCount, mesh.streamElementSize[0]).bytes_fetched;
+            if(attributeWords)
+            {
+                result.bytesFetched += meshopt_analyzeVertexFetch(indices.data(), indices.size(), mesh.vertexCount, mesh.streamElementSize[1]).bytes_fetched;
+            }
+        }
+        else
+        {
+            // the whole interleaved vertex comes in with the cache lines, needed or not
+            result.bytesFetched += meshopt_analyzeVertexFetch(indices.data(), indices.size(), mesh.vertexCount, mesh.streamElementSize[0]).bytes_fetched;
+        }
+        result.vertexInvocations += indices.size();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for(uint32_t it = 0; it != iterations; it++)
+    {
+        for(size_t i = 0; i != m.meshes.size(); i++)
+        {
+            const GPUVertexFormat fmt = gpuVertexFormat(m.meshes[i]);
+            uint32_t positionWords, attributeWords;
+            pulledWords(m.meshes[i].vertexFormat, pass, positionWords, attributeWords);
+
+            for(uint32_t idx : meshIndices[i])
+            {
+                const uint32_t* p = words + fmt.vertexBase + idx * fmt.stride;
+                for(uint32_t w = 0; w != positionWords; w++) { sink += p[w]; }
+
+                const uint32_t* a = words + fmt.attributeBase + idx * fmt.attributeStride;
+                for(uint32_t w = 0; w != attributeWords; w++) { sink += a[w]; }
+            }
+        }
+    }
+    result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+    // keeps the loads alive
+    if(sink == 0x12345678) { printf(" "); }
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    MeshConvertOptions options;
+    options.exportTextures = true;
+    options.exportNormals = true;
+    options.verbose = false;
+    uint32_t iterations = 20;
+
+    for(int i = 2; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if(!strcmp(arg, "--quantize"))                              { options.setQuantized(); }
+        else if(!strcmp(arg, "--optimize"))                         { options.optimize = true; }
+        else if(!strcmp(arg, "--iterations") && i + 1 < argc)       { iterations = std::max(atoi(argv[++i]), 1); }
+        else
+        {
+            printf("Unknown option '%s'\n", arg);
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    ThreadPool pool;
+    PassResult results[2][ePass_Count];
+
+    for(uint32_t layout : { eVertexLayout_Interleaved, eVertexLayout_Split })
+    {
+        options.vertexLayout = layout;
+        MeshConverter converter(options, &pool);
+        if(!converter.loadFile(argv[1])) { return EXIT_FAILURE; }
+
+        for(uint32_t pass = 0; pass != ePass_Count; pass++)
+        {
+            results[layout][pass] = runPass(converter.getMeshData(), static_cast<ePass>(pass), iterations);
+        }
+    }
+
+    printf("%-12s %-11s %14s %12s %12s %12s\n", "layout", "pass", "fetched KiB", "B/vertex", "ms", "ns/vertex");
+    for(uint32_t layout = 0; layout != 2; layout++)
+    {
+        for(uint32_t pass = 0; pass != ePass_Count; pass++)
+        {
+            const PassResult& r = results[layout][pass];
+            const double invocations = double(std::max<uint64_t>(r.vertexInvocations, 1));
+            printf("%-12s %-11s %14.1f %12.2f %12.3f %12.3f\n",
+                kLayoutNames[layout], kPassNames[pass],
+                double(r.bytesFetched) / 1024.0, double(r.bytesFetched) / invocations,
+                r.milliseconds, r.milliseconds * 1e6 / invocations);
+        }
+    }
+
+    const PassResult& interleavedDepth = results[eVertexLayout_Interleaved][ePass_Depth];
+    const PassResult& splitDepth = results[eVertexLayout_Split][ePass_Depth];
+    if(splitDepth.bytesFetched)
+    {
+        printf("Depth-only fetch with split streams: %.2fx less than interleaved\n",
+            double(interleavedDepth.bytesFetched) / double(splitDepth.bytesFetched));
+    }
+
+    return EXIT_SUCCESS;
+}